@@ -28,16 +28,181 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "mixer.h"
+#include "mixer_private.h"
+
+#ifdef MIXER_PROBES
+#include "mixer_probes.h"
+#else
+#define	MIXER_OPEN_ENTRY(name)
+#define	MIXER_OPEN_RETURN(name, unit, error)
+#define	MIXER_CLOSE(unit)
+#define	MIXER_IOCTL_ENTRY(unit, devno, req)
+#define	MIXER_IOCTL_RETURN(unit, devno, req, rc, error)
+#define	MIXER_SYSCTL_ENTRY(name)
+#define	MIXER_SYSCTL_RETURN(name, rc, error)
+#endif
+
+/* Mixer requests are in group 'M', with the device in the low byte. */
+#define	IOCTL_DEVNO(req)	\
+	((((req) >> 8) & 0xff) == 'M' ? (int)((req) & 0xff) : -1)
 
 #define	BASEPATH "/dev/mixer"
+#define	STEP_RETRIES	8
+
+/*
+ * Control names are interned per mixer. Every device normally carries the
+ * same few controls, so this keeps a single copy of each name.
+ */
+struct mix_name {
+	struct mix_name *next;
+	char str[];
+};
+
+/*
+ * Every control the library allocates is one of these. The value type and
+ * typed callbacks are kept out of the public `mix_ctl_t`, so that its
+ * layout stays the same. The control has to come first, so that a
+ * `mix_ctl_t *` can be turned back into its `mix_ctlx`.
+ */
+struct mix_ctlx {
+	mix_ctl_t ctl;
+	const struct mix_ctltype *type;		/* value type, NULL if none */
+	int (*get)(struct mix_dev *, mix_ctlval_t *);
+	int (*set)(struct mix_dev *, const mix_ctlval_t *);
+};
+
+#define CTLX(c)		((struct mix_ctlx *)(c))
+
+/*
+ * Fixed control table of a mixer opened with `mixer_open_into`. The control
+ * has to come first, so that a `mix_ctl_t *` can be turned back into its
+ * slot.
+ */
+struct mix_ctlslot {
+	struct mix_ctlx ctl;
+	struct mix_ctlslot *next;		/* next free slot */
+	char name[MIX_CTLNAMELEN];
+};
+
+struct mix_ctlpool {
+	struct mix_ctlslot *free;		/* free slots */
+};
 
+/*
+ * Each device has a queue of its own, with a worker that is started when the
+ * first operation for the device is submitted.
+ */
+struct mix_asyncq {
+	pthread_t thr;				/* worker thread */
+	pthread_cond_t cv;			/* signaled on new work */
+	TAILQ_HEAD(, mix_op) pending;		/* submitted operations */
+	struct mixer *m;			/* owning mixer */
+	int started;				/* worker is running */
+};
+
+struct mix_async {
+	pthread_mutex_t mtx;			/* protects everything below */
+	struct mix_asyncq q[SOUND_MIXER_NRDEVICES]; /* queue per device */
+	TAILQ_HEAD(, mix_op) done;		/* completed operations */
+	int fds[2];				/* completion pipe */
+	int quit;				/* worker exit flag */
+	pthread_mutex_t maskmtx;		/* serializes mask updates */
+};
+
+/*
+ * All handles to a unit from `mixer_acquire`. The unit is opened once, into
+ * `tmpl`, which is never handed out: the handles are copies of it that
+ * share its descriptor, and nothing writes to it after it is set up, so it
+ * can be copied without a lock.
+ *
+ * The volumes and masks of the unit are kept once, in `st`. Every change
+ * through a handle is stored there, and the handles copy it into their own
+ * structure whenever they are asked for a device or start from a mask.
+ */
+struct mix_share {
+	LIST_ENTRY(mix_share) link;
+	int unit;				/* audio card unit */
+	int refs;				/* handles, and acquires */
+	struct mixer *tmpl;			/* handle opened by the first */
+	pthread_mutex_t mtx;			/* protects `st` */
+	struct snd_mixer_state st;		/* state of the unit */
+};
+
+static LIST_HEAD(, mix_share) _mixer_shares =
+    LIST_HEAD_INITIALIZER(_mixer_shares);
+static pthread_mutex_t _mixer_sharemtx = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *_mixer_devnames[SOUND_MIXER_NRDEVICES] = SOUND_DEVICE_NAMES;
+
+static int _mixer_ioctl(struct mixer *, unsigned long, void *);
+static int _mixer_sysctl(const char *, void *, size_t *, const void *, size_t);
 static int _mixer_readvol(struct mixer *, struct mix_dev *);
+static int _mixer_readstate(struct mixer *, struct snd_mixer_state *);
+static int _mixer_counter(struct mixer *);
+static mix_ctl_t *_mixer_addctl(struct mix_dev *, int, const char *,
+    int (*)(struct mix_dev *, void *), int (*)(struct mix_dev *, void *));
+static int _mixer_ctlcheck(const struct mix_ctltype *);
+static int _mixer_ctlval(const struct mix_ctltype *, const mix_ctlval_t *,
+    mix_ctlval_t *);
+static const char *_mixer_intern(struct mixer *, const char *);
+static int _mixer_modmute(int *, int, int);
+static int _mixer_modrecsrc(int *, int, int);
+static struct mixer *_mixer_view(struct mixer *);
+static void _mixer_unshare(struct mix_share *);
+static void _mixer_shload(struct mixer *);
+static void _mixer_shstore(struct mixer *, int, int);
+static int _mixer_async_init(struct mixer *);
+static void _mixer_async_fini(struct mixer *);
+static void _mixer_async_exec(struct mixer *, mix_op_t *);
+static void *_mixer_async_worker(void *);
+
+/*
+ * Every ioctl goes through here, so that it can be traced. For the mixer
+ * read and write requests, the low byte of the request is the device number.
+ * `unit` is -1 for dsp descriptors.
+ */
+int
+_mixer_fdioctl(int fd, int unit, unsigned long req, void *arg)
+{
+	int rc;
+
+	MIXER_IOCTL_ENTRY(unit, IOCTL_DEVNO(req), req);
+	rc = ioctl(fd, req, arg);
+	MIXER_IOCTL_RETURN(unit, IOCTL_DEVNO(req), req, rc,
+	    rc < 0 ? errno : 0);
+
+	return (rc);
+}
+
+static int
+_mixer_ioctl(struct mixer *m, unsigned long req, void *arg)
+{
+	return (_mixer_fdioctl(m->fd, m->unit, req, arg));
+}
+
+/*
+ * Same as `_mixer_ioctl`, for sysctls.
+ */
+static int
+_mixer_sysctl(const char *name, void *old, size_t *oldlen, const void *new,
+    size_t newlen)
+{
+	int rc;
+
+	MIXER_SYSCTL_ENTRY(name);
+	rc = sysctlbyname(name, old, oldlen, new, newlen);
+	MIXER_SYSCTL_RETURN(name, rc, rc < 0 ? errno : 0);
+
+	return (rc);
+}
 
 /*
  * Fetch volume from the device.
@@ -47,33 +212,95 @@ _mixer_readvol(struct mixer *m, struct mix_dev *dev)
 {
 	int v;
 
-	if (ioctl(m->fd, MIXER_READ(dev->devno), &v) < 0)
+	if (_mixer_ioctl(m, MIXER_READ(dev->devno), &v) < 0)
 		return (-1);
 	dev->vol.left = MIX_VOLNORM(v & 0x00ff);
 	dev->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+	_mixer_shstore(m, dev->devno, v);
 
 	return (0);
 }
 
 /*
- * Open a mixer device in `/dev/mixerN`, where N is the number of the mixer.
- * Each device maps to an actual pcm audio card, so `/dev/mixer0` is the
- * mixer for pcm0, and so on.
- *
- * @param name		path to mixer device. NULL or "/dev/mixer" for the
- *			the default mixer (i.e `hw.snd.default_unit`).
+ * Take a snapshot of the masks and of the volumes of all devices. Drivers
+ * with SOUND_MIXER_READ_STATE hand it over in one ioctl; with the others it
+ * takes one per mask and per device, and the modify counter is left at -1.
  */
-struct mixer *
-mixer_open(const char *name)
+static int
+_mixer_readstate(struct mixer *m, struct snd_mixer_state *st)
 {
-	struct mixer *m = NULL;
-	struct mix_dev *dp;
-	const char *names[SOUND_MIXER_NRDEVICES] = SOUND_DEVICE_NAMES;
 	int i;
 
-	if ((m = calloc(1, sizeof(struct mixer))) == NULL)
-		goto fail;
+	if (_mixer_ioctl(m, SOUND_MIXER_READ_STATE, st) == 0)
+		return (0);
+	/* Anything but "not supported" is a real error. */
+	if (errno != ENXIO && errno != EINVAL && errno != ENOTTY)
+		return (-1);
+
+	memset(st, 0, sizeof(struct snd_mixer_state));
+	st->modify_counter = -1;
+	if (_mixer_ioctl(m, SOUND_MIXER_READ_DEVMASK, &st->devmask) < 0 ||
+	    _mixer_ioctl(m, SOUND_MIXER_READ_MUTE, &st->mutedevs) < 0 ||
+	    _mixer_ioctl(m, SOUND_MIXER_READ_RECMASK, &st->recmask) < 0 ||
+	    _mixer_ioctl(m, SOUND_MIXER_READ_RECSRC, &st->recsrc) < 0)
+		return (-1);
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
+		if (MIX_ISSET(i, st->devmask) &&
+		    _mixer_ioctl(m, MIXER_READ(i), &st->level[i]) < 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Fetch the mixer's modify counter, which the driver increments on every
+ * volume change. Returns -1 if the counter is not available.
+ */
+static int
+_mixer_counter(struct mixer *m)
+{
+	oss_mixerinfo mi;
+
+	mi.dev = m->unit;
+	if (m->unit < 0 || _mixer_ioctl(m, SNDCTL_MIXERINFO, &mi) < 0)
+		return (-1);
+
+	return (mi.modify_counter);
+}
+
+/*
+ * Return the mixer's copy of `str`, creating it if needed.
+ */
+static const char *
+_mixer_intern(struct mixer *m, const char *str)
+{
+	struct mix_name *np;
+	size_t len;
 
+	for (np = m->names; np != NULL; np = np->next) {
+		if (!strcmp(np->str, str))
+			return (np->str);
+	}
+	len = strlen(str) + 1;
+	if ((np = malloc(sizeof(struct mix_name) + len)) == NULL)
+		return (NULL);
+	memcpy(np->str, str, len);
+	np->next = m->names;
+	m->names = np;
+
+	return (np->str);
+}
+
+/*
+ * Open the device and take a snapshot of it in `st`, which the devices'
+ * volumes are set from later on. Shared by `mixer_open` and
+ * `mixer_open_into`, so it must not allocate.
+ */
+static int
+_mixer_init(struct mixer *m, const char *name, struct snd_mixer_state *st)
+{
+	m->fd = -1;
 	if (name != NULL) {
 		/* `name` does not start with "/dev/mixer". */
 		if (strncmp(name, BASEPATH, strlen(BASEPATH)) != 0) {
@@ -88,12 +315,12 @@ mixer_open(const char *name)
 	} else {
 dunit:
 		if ((m->unit = mixer_get_dunit()) < 0)
-			goto fail;
+			return (-1);
 		(void)snprintf(m->name, sizeof(m->name), "/dev/mixer%d", m->unit);
 	}
 
 	if ((m->fd = open(m->name, O_RDWR)) < 0)
-		goto fail;
+		return (-1);
 
 	m->devmask = m->recmask = m->recsrc = 0;
 	m->f_default = m->unit == mixer_get_dunit();
@@ -101,46 +328,182 @@ dunit:
 	/* The unit number _must_ be set before the ioctl. */
 	m->mi.dev = m->unit;
 	m->ci.card = m->unit;
-	if (ioctl(m->fd, SNDCTL_MIXERINFO, &m->mi) < 0) {
+	if (_mixer_ioctl(m, SNDCTL_MIXERINFO, &m->mi) < 0) {
 		memset(&m->mi, 0, sizeof(m->mi));
 		strlcpy(m->mi.name, m->name, sizeof(m->mi.name));
 	}
-	if (ioctl(m->fd, SNDCTL_CARDINFO, &m->ci) < 0)
+	if (_mixer_ioctl(m, SNDCTL_CARDINFO, &m->ci) < 0)
 		memset(&m->ci, 0, sizeof(m->ci));
-	if (ioctl(m->fd, SOUND_MIXER_READ_DEVMASK, &m->devmask) < 0 ||
-	    ioctl(m->fd, SOUND_MIXER_READ_MUTE, &m->mutemask) < 0 ||
-	    ioctl(m->fd, SOUND_MIXER_READ_RECMASK, &m->recmask) < 0 ||
-	    ioctl(m->fd, SOUND_MIXER_READ_RECSRC, &m->recsrc) < 0)
-		goto fail;
+	if (_mixer_readstate(m, st) < 0)
+		return (-1);
+	m->devmask = st->devmask;
+	m->mutemask = st->mutedevs;
+	m->recmask = st->recmask;
+	m->recsrc = st->recsrc;
+
+	return (0);
+}
+
+/*
+ * Set up the devices in the `dp` array, which has room for all of them,
+ * with their volumes from `st`.
+ */
+static void
+_mixer_initdevs(struct mixer *m, struct mix_dev *dp,
+    const struct snd_mixer_state *st)
+{
+	int i;
 
 	TAILQ_INIT(&m->devs);
 	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
 		if (!MIX_ISDEV(m, i))
 			continue;
-		if ((dp = calloc(1, sizeof(struct mix_dev))) == NULL)
-			goto fail;
+		memset(dp, 0, sizeof(struct mix_dev));
 		dp->parent_mixer = m;
 		dp->devno = i;
 		dp->nctl = 0;
-		if (_mixer_readvol(m, dp) < 0)
-			goto fail;
-		(void)strlcpy(dp->name, names[i], sizeof(dp->name));
+		dp->name = _mixer_devnames[i];
 		TAILQ_INIT(&dp->ctls);
 		TAILQ_INSERT_TAIL(&m->devs, dp, devs);
 		m->ndev++;
+		dp->vol.left = MIX_VOLNORM(st->level[i] & 0x00ff);
+		dp->vol.right = MIX_VOLNORM((st->level[i] >> 8) & 0x00ff);
+		dp++;
 	}
 
 	/* The default device is always "vol". */
 	m->dev = TAILQ_FIRST(&m->devs);
+}
+
+/*
+ * Open a mixer device in `/dev/mixerN`, where N is the number of the mixer.
+ * Each device maps to an actual pcm audio card, so `/dev/mixer0` is the
+ * mixer for pcm0, and so on.
+ *
+ * @param name		path to mixer device. NULL or "/dev/mixer" for the
+ *			the default mixer (i.e `hw.snd.default_unit`).
+ */
+struct mixer *
+mixer_open(const char *name)
+{
+	struct snd_mixer_state st;
+	struct mixer *m = NULL, *p;
+	int i, n;
+
+	MIXER_OPEN_ENTRY(name);
+	if ((m = calloc(1, sizeof(struct mixer))) == NULL)
+		goto fail;
+	if (_mixer_init(m, name, &st) < 0)
+		goto fail;
+
+	/*
+	 * Keep the devices right after the mixer structure, so that the
+	 * whole handle is a single allocation and walking the device list
+	 * touches consecutive memory.
+	 */
+	for (i = 0, n = 0; i < SOUND_MIXER_NRDEVICES; i++)
+		n += MIX_ISDEV(m, i);
+	if ((p = realloc(m, sizeof(struct mixer) +
+	    n * sizeof(struct mix_dev))) == NULL)
+		goto fail;
+	m = p;
+	_mixer_initdevs(m, (struct mix_dev *)(m + 1), &st);
+	MIXER_OPEN_RETURN(name, m->unit, 0);
 
 	return (m);
 fail:
+	MIXER_OPEN_RETURN(name, -1, errno);
 	if (m != NULL)
 		(void)mixer_close(m);
 
 	return (NULL);
 }
 
+/*
+ * Return the size of the storage `mixer_open_into` needs for any mixer,
+ * with room for `nctl` controls in total.
+ */
+size_t
+mixer_open_size(int nctl)
+{
+	if (nctl < 0)
+		nctl = 0;
+
+	return (sizeof(struct mixer) +
+	    SOUND_MIXER_NRDEVICES * sizeof(struct mix_dev) +
+	    sizeof(struct mix_ctlpool) + nctl * sizeof(struct mix_ctlslot));
+}
+
+/*
+ * Same as `mixer_open`, but build the handle in `buf` instead of allocating
+ * it. The devices come right after the mixer, and the rest of the buffer
+ * is a fixed table that `mixer_add_ctl` takes controls from. Nothing is
+ * allocated and no locks are taken, so that the mixer can be opened and
+ * used from real-time threads.
+ *
+ * @param buf		storage for the handle, aligned for a pointer.
+ * @param size		size of `buf`, see `mixer_open_size`.
+ * @param name		same as in `mixer_open`.
+ */
+struct mixer *
+mixer_open_into(void *buf, size_t size, const char *name)
+{
+	struct snd_mixer_state st;
+	struct mixer *m = buf;
+	struct mix_ctlpool *pool;
+	struct mix_ctlslot *sp;
+	size_t used;
+	int i, n;
+
+	MIXER_OPEN_ENTRY(name);
+	/* Nothing in `buf` can be trusted yet, not even `m->fd`. */
+	if (buf == NULL || ((uintptr_t)buf & (sizeof(void *) - 1)) != 0) {
+		errno = EINVAL;
+		MIXER_OPEN_RETURN(name, -1, errno);
+		return (NULL);
+	}
+	if (size < sizeof(struct mixer)) {
+		errno = ENOMEM;
+		MIXER_OPEN_RETURN(name, -1, errno);
+		return (NULL);
+	}
+	memset(m, 0, sizeof(struct mixer));
+	if (_mixer_init(m, name, &st) < 0)
+		goto fail;
+
+	for (i = 0, n = 0; i < SOUND_MIXER_NRDEVICES; i++)
+		n += MIX_ISDEV(m, i);
+	used = sizeof(struct mixer) + n * sizeof(struct mix_dev);
+	if (size < used + sizeof(struct mix_ctlpool)) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	_mixer_initdevs(m, (struct mix_dev *)(m + 1), &st);
+
+	/* Everything after the pool header is control slots. */
+	pool = (struct mix_ctlpool *)((char *)buf + used);
+	pool->free = NULL;
+	n = (size - used - sizeof(struct mix_ctlpool)) /
+	    sizeof(struct mix_ctlslot);
+	for (sp = (struct mix_ctlslot *)(pool + 1) + n - 1; n > 0; n--, sp--) {
+		sp->next = pool->free;
+		pool->free = sp;
+	}
+	m->ctlpool = pool;
+	MIXER_OPEN_RETURN(name, m->unit, 0);
+
+	return (m);
+fail:
+	MIXER_OPEN_RETURN(name, -1, errno);
+	if (m->fd >= 0) {
+		i = errno;
+		(void)close(m->fd);
+		errno = i;
+	}
+
+	return (NULL);
+}
+
 /*
  * Free resources and close the mixer.
  */
@@ -148,21 +511,272 @@ int
 mixer_close(struct mixer *m)
 {
 	struct mix_dev *dp;
+	struct mix_name *np;
 	int r;
 
-	r = close(m->fd);
-	while (!TAILQ_EMPTY(&m->devs)) {
-		dp = TAILQ_FIRST(&m->devs);
-		TAILQ_REMOVE(&m->devs, dp, devs);
+	if (m->share != NULL)
+		return (mixer_release(m));
+	MIXER_CLOSE(m->unit);
+	/* The worker has to be gone before the descriptor is. */
+	if (m->async != NULL)
+		_mixer_async_fini(m);
+	r = m->fd >= 0 ? close(m->fd) : 0;
+	/* The caller owns the storage from `mixer_open_into`. */
+	if (m->ctlpool != NULL)
+		return (r);
+	/* Devices live in the same allocation as the mixer. */
+	TAILQ_FOREACH(dp, &m->devs, devs) {
 		while (!TAILQ_EMPTY(&dp->ctls))
 			(void)mixer_remove_ctl(TAILQ_FIRST(&dp->ctls));
-		free(dp);
+	}
+	while ((np = m->names) != NULL) {
+		m->names = np->next;
+		free(np);
 	}
 	free(m);
 
 	return (r);
 }
 
+/*
+ * Re-read the masks and the volumes of all devices, which other programs
+ * may have changed since the mixer was opened. With drivers that support
+ * it, this takes a single ioctl.
+ */
+int
+mixer_refresh(struct mixer *m)
+{
+	struct snd_mixer_state st;
+	struct mix_dev *dp;
+	int v;
+
+	if (_mixer_readstate(m, &st) < 0)
+		return (-1);
+	m->mutemask = st.mutedevs;
+	m->recmask = st.recmask;
+	m->recsrc = st.recsrc;
+	if (st.modify_counter >= 0)
+		m->mi.modify_counter = st.modify_counter;
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		v = st.level[dp->devno];
+		dp->vol.left = MIX_VOLNORM(v & 0x00ff);
+		dp->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+	}
+	if (m->share != NULL) {
+		pthread_mutex_lock(&m->share->mtx);
+		m->share->st = st;
+		pthread_mutex_unlock(&m->share->mtx);
+	}
+
+	return (0);
+}
+
+/*
+ * Make a new handle to the same device as `tp`, for `mixer_acquire`. It
+ * takes the descriptor and a copy of the state from `tp`, so this involves
+ * no system calls, but none of its controls.
+ */
+static struct mixer *
+_mixer_view(struct mixer *tp)
+{
+	struct mixer *m;
+	struct mix_dev *dp, *tdp;
+
+	if ((m = malloc(sizeof(struct mixer) +
+	    tp->ndev * sizeof(struct mix_dev))) == NULL)
+		return (NULL);
+	memcpy(m, tp, sizeof(struct mixer));
+	m->async = NULL;
+	m->names = NULL;
+	TAILQ_INIT(&m->devs);
+	dp = (struct mix_dev *)(m + 1);
+	TAILQ_FOREACH(tdp, &tp->devs, devs) {
+		dp->devno = tdp->devno;
+		dp->vol = tdp->vol;
+		dp->nctl = 0;
+		dp->parent_mixer = m;
+		dp->name = tdp->name;
+		TAILQ_INIT(&dp->ctls);
+		TAILQ_INSERT_TAIL(&m->devs, dp, devs);
+		dp++;
+	}
+	m->dev = TAILQ_FIRST(&m->devs);
+
+	return (m);
+}
+
+/*
+ * Drop a reference to a share, and the share itself with the last one.
+ */
+static void
+_mixer_unshare(struct mix_share *s)
+{
+	struct mixer *tmpl = NULL;
+
+	pthread_mutex_lock(&_mixer_sharemtx);
+	if (--s->refs == 0) {
+		LIST_REMOVE(s, link);
+		tmpl = s->tmpl;
+		pthread_mutex_destroy(&s->mtx);
+		free(s);
+	}
+	pthread_mutex_unlock(&_mixer_sharemtx);
+	/* Closing may block, so not under the lock. */
+	if (tmpl != NULL)
+		(void)mixer_close(tmpl);
+}
+
+/*
+ * Bring the volumes and masks of a handle from `mixer_acquire` up to date
+ * with the state of its unit.
+ */
+static void
+_mixer_shload(struct mixer *m)
+{
+	struct mix_share *s = m->share;
+	struct mix_dev *dp;
+	int v;
+
+	if (s == NULL)
+		return;
+	pthread_mutex_lock(&s->mtx);
+	m->mutemask = s->st.mutedevs;
+	m->recsrc = s->st.recsrc;
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		v = s->st.level[dp->devno];
+		dp->vol.left = MIX_VOLNORM(v & 0x00ff);
+		dp->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+	}
+	pthread_mutex_unlock(&s->mtx);
+}
+
+/*
+ * Store a value read back from the device in the state of the unit, if `m`
+ * is from `mixer_acquire`. As with MIXER_READ(), `devno` is a device number,
+ * or SOUND_MIXER_MUTE or SOUND_MIXER_RECSRC for the masks.
+ */
+static void
+_mixer_shstore(struct mixer *m, int devno, int v)
+{
+	struct mix_share *s = m->share;
+
+	if (s == NULL)
+		return;
+	pthread_mutex_lock(&s->mtx);
+	if (devno == SOUND_MIXER_MUTE)
+		s->st.mutedevs = v;
+	else if (devno == SOUND_MIXER_RECSRC)
+		s->st.recsrc = v;
+	else
+		s->st.level[devno] = v;
+	pthread_mutex_unlock(&s->mtx);
+}
+
+/*
+ * Get a handle to mixer `unit` that shares its descriptor with the rest of
+ * the process. The first call for a unit opens it; later ones only copy the
+ * devices and read the state through the same descriptor, which takes a
+ * single ioctl. Each handle has its own controls and selected device, and
+ * is used like one from `mixer_open`. The volumes and masks are those of
+ * the unit, so a change made through one handle shows in the others the
+ * next time they look up a device; changes by other programs still show
+ * only after `mixer_refresh`.
+ *
+ * @param unit		the audio card number, or -1 for the default mixer.
+ */
+struct mixer *
+mixer_acquire(int unit)
+{
+	struct mix_share *s, *ns = NULL;
+	struct mixer *m, *tmpl = NULL;
+	char name[NAME_MAX];
+	int e;
+
+	if (unit < 0 && (unit = mixer_get_dunit()) < 0)
+		return (NULL);
+	pthread_mutex_lock(&_mixer_sharemtx);
+	LIST_FOREACH(s, &_mixer_shares, link) {
+		if (s->unit == unit)
+			break;
+	}
+	if (s != NULL)
+		s->refs++;
+	pthread_mutex_unlock(&_mixer_sharemtx);
+	if (s == NULL) {
+		/* Open without the lock, then look again. */
+		(void)snprintf(name, sizeof(name), BASEPATH "%d", unit);
+		if ((ns = calloc(1, sizeof(struct mix_share))) == NULL)
+			return (NULL);
+		if ((tmpl = mixer_open(name)) == NULL) {
+			free(ns);
+			return (NULL);
+		}
+		(void)pthread_mutex_init(&ns->mtx, NULL);
+		pthread_mutex_lock(&_mixer_sharemtx);
+		LIST_FOREACH(s, &_mixer_shares, link) {
+			if (s->unit == unit)
+				break;
+		}
+		if (s == NULL) {
+			s = ns;
+			s->unit = unit;
+			s->tmpl = tmpl;
+			LIST_INSERT_HEAD(&_mixer_shares, s, link);
+			ns = NULL;
+			tmpl = NULL;
+		}
+		s->refs++;
+		pthread_mutex_unlock(&_mixer_sharemtx);
+		/* Someone else opened the unit in the meantime. */
+		if (tmpl != NULL) {
+			(void)mixer_close(tmpl);
+			pthread_mutex_destroy(&ns->mtx);
+			free(ns);
+		}
+	}
+	/* The reference keeps `s->tmpl` around. */
+	if ((m = _mixer_view(s->tmpl)) == NULL) {
+		e = errno;
+		_mixer_unshare(s);
+		errno = e;
+		return (NULL);
+	}
+	m->share = s;
+	if (mixer_refresh(m) < 0) {
+		e = errno;
+		(void)mixer_release(m);
+		errno = e;
+		return (NULL);
+	}
+
+	return (m);
+}
+
+/*
+ * Release a handle from `mixer_acquire`, along with its controls. The
+ * device is closed when its last handle is released.
+ */
+int
+mixer_release(struct mixer *m)
+{
+	struct mix_share *s;
+
+	if (m == NULL || (s = m->share) == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	/* The worker still uses the descriptor. */
+	if (m->async != NULL)
+		_mixer_async_fini(m);
+	/* The descriptor belongs to the share. */
+	m->fd = -1;
+	m->share = NULL;
+	(void)mixer_close(m);
+	_mixer_unshare(s);
+
+	return (0);
+}
+
 /*
  * Select a mixer device. The mixer structure keeps a list of all the devices
  * the mixer has, but only one can be manipulated at a time -- this is what
@@ -180,6 +794,7 @@ mixer_get_dev(struct mixer *m, int dev)
 		errno = ERANGE;
 		return (NULL);
 	}
+	_mixer_shload(m);
 	TAILQ_FOREACH(dp, &m->devs, devs) {
 		if (dp->devno == dev)
 			return (dp);
@@ -199,8 +814,9 @@ mixer_get_dev_byname(struct mixer *m, const char *name)
 {
 	struct mix_dev *dp;
 
+	_mixer_shload(m);
 	TAILQ_FOREACH(dp, &m->devs, devs) {
-		if (!strncmp(dp->name, name, sizeof(dp->name)))
+		if (!strcmp(dp->name, name))
 			return (dp);
 	}
 	errno = EINVAL;
@@ -209,43 +825,154 @@ mixer_get_dev_byname(struct mixer *m, const char *name)
 }
 
 /*
- * Add a mixer control to a device.
+ * Accessors for the fields of a device. Unlike the fields, they do not
+ * depend on the layout of the structure, which may change between
+ * releases.
  */
+const char *
+mixer_dev_name(const struct mix_dev *d)
+{
+	return (d->name);
+}
+
 int
-mixer_add_ctl(struct mix_dev *parent_dev, int id, const char *name,
+mixer_dev_devno(const struct mix_dev *d)
+{
+	return (d->devno);
+}
+
+mix_volume_t
+mixer_dev_vol(const struct mix_dev *d)
+{
+	struct mix_share *s = d->parent_mixer->share;
+	mix_volume_t vol;
+	int v;
+
+	if (s == NULL)
+		return (d->vol);
+	pthread_mutex_lock(&s->mtx);
+	v = s->st.level[d->devno];
+	pthread_mutex_unlock(&s->mtx);
+	vol.left = MIX_VOLNORM(v & 0x00ff);
+	vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+
+	return (vol);
+}
+
+/*
+ * Walk the devices of a mixer. Returns the first device if `d` is NULL,
+ * the one after `d` otherwise, and NULL after the last one.
+ */
+struct mix_dev *
+mixer_dev_next(struct mixer *m, struct mix_dev *d)
+{
+	if (d == NULL) {
+		_mixer_shload(m);
+		return (TAILQ_FIRST(&m->devs));
+	}
+
+	return (TAILQ_NEXT(d, devs));
+}
+
+/*
+ * Allocate a control and link it to `parent_dev`. The control starts out
+ * untyped.
+ */
+static mix_ctl_t *
+_mixer_addctl(struct mix_dev *parent_dev, int id, const char *name,
     int (*mod)(struct mix_dev *, void *),
     int (*print)(struct mix_dev *, void *))
 {
 	struct mix_dev *dp;
+	struct mix_ctlpool *pool;
+	struct mix_ctlslot *sp;
 	mix_ctl_t *ctl, *cp;
 
-	/* XXX: should we accept NULL name? */
-	if (parent_dev == NULL) {
+	if (parent_dev == NULL || name == NULL) {
 		errno = EINVAL;
-		return (-1);
+		return (NULL);
 	}
-	if ((ctl = calloc(1, sizeof(mix_ctl_t))) == NULL)
-		return (-1);
-	ctl->parent_dev = parent_dev;
-	ctl->id = id;
-	if (name != NULL)
-		(void)strlcpy(ctl->name, name, sizeof(ctl->name));
-	ctl->mod = mod;
-	ctl->print = print;
-	dp = ctl->parent_dev;
+	dp = parent_dev;
 	/* Make sure the same ID or name doesn't exist already. */
 	TAILQ_FOREACH(cp, &dp->ctls, ctls) {
-		if (!strncmp(cp->name, name, sizeof(cp->name)) || cp->id == id) {
+		if (!strcmp(cp->name, name) || cp->id == id) {
 			errno = EINVAL;
-			return (-1);
+			return (NULL);
 		}
 	}
+	if ((pool = dp->parent_mixer->ctlpool) != NULL) {
+		if (strlen(name) >= MIX_CTLNAMELEN) {
+			errno = ENAMETOOLONG;
+			return (NULL);
+		}
+		if ((sp = pool->free) == NULL) {
+			errno = ENOSPC;
+			return (NULL);
+		}
+		pool->free = sp->next;
+		(void)strlcpy(sp->name, name, sizeof(sp->name));
+		ctl = &sp->ctl.ctl;
+		ctl->name = sp->name;
+	} else {
+		if ((ctl = calloc(1, sizeof(struct mix_ctlx))) == NULL)
+			return (NULL);
+		if ((ctl->name = _mixer_intern(dp->parent_mixer,
+		    name)) == NULL) {
+			free(ctl);
+			return (NULL);
+		}
+	}
+	ctl->parent_dev = parent_dev;
+	ctl->id = id;
+	ctl->mod = mod;
+	ctl->print = print;
+	CTLX(ctl)->type = NULL;
+	CTLX(ctl)->get = NULL;
+	CTLX(ctl)->set = NULL;
 	TAILQ_INSERT_TAIL(&dp->ctls, ctl, ctls);
 	dp->nctl++;
 
+	return (ctl);
+}
+
+/*
+ * Add a mixer control to a device.
+ */
+int
+mixer_add_ctl(struct mix_dev *parent_dev, int id, const char *name,
+    int (*mod)(struct mix_dev *, void *),
+    int (*print)(struct mix_dev *, void *))
+{
+	if (_mixer_addctl(parent_dev, id, name, mod, print) == NULL)
+		return (-1);
+
 	return (0);
 }
 
+/*
+ * Check that a control type descriptor makes sense.
+ */
+static int
+_mixer_ctlcheck(const struct mix_ctltype *t)
+{
+	switch (t->type) {
+	case MIX_CTL_VOLUME:
+	case MIX_CTL_BOOL:
+		return (0);
+	case MIX_CTL_ENUM:
+		if (t->nitems > 0 && t->items != NULL)
+			return (0);
+		break;
+	case MIX_CTL_RANGE:
+		if (t->min <= t->max)
+			return (0);
+		break;
+	}
+	errno = EINVAL;
+
+	return (-1);
+}
+
 /*
  * Same as `mixer_add_ctl`.
  */
@@ -259,6 +986,37 @@ mixer_add_ctl_s(mix_ctl_t *ctl)
 	    ctl->mod, ctl->print));
 }
 
+/*
+ * Add a control whose value has the type `type`, and is read and written
+ * through `get` and `set` by `mixer_ctl_get` and `mixer_ctl_set`. Either
+ * callback may be NULL for a read-only or write-only control. The control
+ * has no `mod` or `print` handler.
+ *
+ * @param type		value type, has to stay valid as long as the control.
+ */
+int
+mixer_add_ctl_typed(struct mix_dev *parent_dev, int id, const char *name,
+    const struct mix_ctltype *type,
+    int (*get)(struct mix_dev *, mix_ctlval_t *),
+    int (*set)(struct mix_dev *, const mix_ctlval_t *))
+{
+	mix_ctl_t *ctl;
+
+	if (type == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (_mixer_ctlcheck(type) < 0)
+		return (-1);
+	if ((ctl = _mixer_addctl(parent_dev, id, name, NULL, NULL)) == NULL)
+		return (-1);
+	CTLX(ctl)->type = type;
+	CTLX(ctl)->get = get;
+	CTLX(ctl)->set = set;
+
+	return (0);
+}
+
 /*
  * Remove a mixer control from a device.
  */
@@ -266,6 +1024,8 @@ int
 mixer_remove_ctl(mix_ctl_t *ctl)
 {
 	struct mix_dev *p;
+	struct mix_ctlpool *pool;
+	struct mix_ctlslot *sp;
 
 	if (ctl == NULL) {
 		errno = EINVAL;
@@ -274,7 +1034,12 @@ mixer_remove_ctl(mix_ctl_t *ctl)
 	p = ctl->parent_dev;
 	if (!TAILQ_EMPTY(&p->ctls)) {
 		TAILQ_REMOVE(&p->ctls, ctl, ctls);
-		free(ctl);
+		if ((pool = p->parent_mixer->ctlpool) != NULL) {
+			sp = (struct mix_ctlslot *)ctl;
+			sp->next = pool->free;
+			pool->free = sp;
+		} else
+			free(ctl);
 	}
 
 	return (0);
@@ -286,32 +1051,197 @@ mixer_remove_ctl(mix_ctl_t *ctl)
 mix_ctl_t *
 mixer_get_ctl(struct mix_dev *d, int id)
 {
-	mix_ctl_t *cp;
+	mix_ctl_t *cp;
+
+	TAILQ_FOREACH(cp, &d->ctls, ctls) {
+		if (cp->id == id)
+			return (cp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+
+/*
+ * Get a mixer control by name.
+ */
+mix_ctl_t *
+mixer_get_ctl_byname(struct mix_dev *d, const char *name)
+{
+	mix_ctl_t *cp;
+
+	TAILQ_FOREACH(cp, &d->ctls, ctls) {
+		if (!strcmp(cp->name, name))
+			return (cp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+
+/*
+ * Same as the device accessors, for controls.
+ */
+const char *
+mixer_ctl_name(const mix_ctl_t *ctl)
+{
+	return (ctl->name);
+}
+
+int
+mixer_ctl_id(const mix_ctl_t *ctl)
+{
+	return (ctl->id);
+}
+
+/*
+ * Walk the controls of a device, like `mixer_dev_next`.
+ */
+mix_ctl_t *
+mixer_ctl_next(struct mix_dev *d, mix_ctl_t *ctl)
+{
+	return (ctl == NULL ? TAILQ_FIRST(&d->ctls) : TAILQ_NEXT(ctl, ctls));
+}
+
+/*
+ * Check `in` against the value type `t` and store it, normalized, in `out`.
+ */
+static int
+_mixer_ctlval(const struct mix_ctltype *t, const mix_ctlval_t *in,
+    mix_ctlval_t *out)
+{
+	*out = *in;
+	switch (t->type) {
+	case MIX_CTL_VOLUME:
+		if (in->vol.left < MIX_VOLMIN || in->vol.left > MIX_VOLMAX ||
+		    in->vol.right < MIX_VOLMIN || in->vol.right > MIX_VOLMAX)
+			goto range;
+		break;
+	case MIX_CTL_BOOL:
+		out->b = in->b != 0;
+		break;
+	case MIX_CTL_ENUM:
+		if (in->e < 0 || in->e >= t->nitems)
+			goto range;
+		break;
+	case MIX_CTL_RANGE:
+		if (in->i < t->min || in->i > t->max)
+			goto range;
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (0);
+range:
+	errno = ERANGE;
+
+	return (-1);
+}
+
+/*
+ * Read the value of a typed control into `val`. The member of `val` that
+ * is filled in depends on the control's type.
+ */
+int
+mixer_ctl_get(mix_ctl_t *ctl, mix_ctlval_t *val)
+{
+	if (ctl == NULL || val == NULL || CTLX(ctl)->type == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (CTLX(ctl)->get == NULL) {
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+
+	return (CTLX(ctl)->get(ctl->parent_dev, val));
+}
+
+/*
+ * Set a typed control to `val`. The value is checked against the control's
+ * type before the control's `set` callback sees it; booleans are
+ * normalized to 0 or 1.
+ */
+int
+mixer_ctl_set(mix_ctl_t *ctl, const mix_ctlval_t *val)
+{
+	mix_ctlval_t v;
+
+	if (ctl == NULL || val == NULL || CTLX(ctl)->type == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (CTLX(ctl)->set == NULL) {
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+	if (_mixer_ctlval(CTLX(ctl)->type, val, &v) < 0)
+		return (-1);
+
+	return (CTLX(ctl)->set(ctl->parent_dev, &v));
+}
+
+/*
+ * Read `n` controls. Every request gets its own `error`, so one failing
+ * control does not stop the rest from being read.
+ *
+ * Returns 0, or -1 with errno set to the first error if any request
+ * failed.
+ */
+int
+mixer_ctl_get_many(struct mix_ctlreq *req, int n)
+{
+	int i, e = 0;
 
-	TAILQ_FOREACH(cp, &d->ctls, ctls) {
-		if (cp->id == id)
-			return (cp);
+	if (req == NULL || n < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		req[i].error = 0;
+		if (mixer_ctl_get(req[i].ctl, &req[i].val) < 0) {
+			req[i].error = errno;
+			if (e == 0)
+				e = errno;
+		}
+	}
+	if (e != 0) {
+		errno = e;
+		return (-1);
 	}
-	errno = EINVAL;
 
-	return (NULL);
+	return (0);
 }
 
 /*
- * Get a mixer control by name.
+ * Same as `mixer_ctl_get_many`, but sets each control to its request's
+ * value, in order.
  */
-mix_ctl_t *
-mixer_get_ctl_byname(struct mix_dev *d, const char *name)
+int
+mixer_ctl_set_many(struct mix_ctlreq *req, int n)
 {
-	mix_ctl_t *cp;
+	int i, e = 0;
 
-	TAILQ_FOREACH(cp, &d->ctls, ctls) {
-		if (!strncmp(cp->name, name, sizeof(cp->name)))
-			return (cp);
+	if (req == NULL || n < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		req[i].error = 0;
+		if (mixer_ctl_set(req[i].ctl, &req[i].val) < 0) {
+			req[i].error = errno;
+			if (e == 0)
+				e = errno;
+		}
+	}
+	if (e != 0) {
+		errno = e;
+		return (-1);
 	}
-	errno = EINVAL;
 
-	return (NULL);
+	return (0);
 }
 
 /*
@@ -334,7 +1264,7 @@ mixer_set_vol(struct mixer *m, mix_volume_t vol)
 		return (-1);
 	}
 	v = MIX_VOLDENORM(vol.left) | MIX_VOLDENORM(vol.right) << 8;
-	if (ioctl(m->fd, MIXER_WRITE(m->dev->devno), &v) < 0)
+	if (_mixer_ioctl(m, MIXER_WRITE(m->dev->devno), &v) < 0)
 		return (-1);
 	if (_mixer_readvol(m, m->dev) < 0)
 		return (-1);
@@ -343,35 +1273,181 @@ mixer_set_vol(struct mixer *m, mix_volume_t vol)
 }
 
 /*
- * Manipulate a device's mute.
+ * Change a device's volume by a relative amount. Unlike computing the new
+ * volume from `vol` and calling `mixer_set_vol`, the step is applied to the
+ * level the device has right now, so concurrent changes by other programs
+ * are not lost.
  *
- * @param opt		MIX_MUTE mute device
- *			MIX_UNMUTE unmute device
- *			MIX_TOGGLEMUTE toggle device's mute
+ * Kernels that support SOUND_MIXER_STEP apply the step atomically with
+ * a single ioctl. Otherwise, the level is read and the step is written only
+ * if the mixer's modify counter did not move in the meantime, retrying a few
+ * times if it did, and failing with EAGAIN if it kept moving. No lock is
+ * taken, so a change by another thread or program can still slip in between
+ * the last check of the counter and the write. Without a modify counter,
+ * e.g. on a mixer opened by path, the step fails with EOPNOTSUPP.
+ *
+ * The resulting volume is clamped between MIX_VOLMIN and MIX_VOLMAX.
+ *
+ * @param dl		left volume step
+ * @param dr		right volume step
  */
 int
-mixer_set_mute(struct mixer *m, int opt)
+mixer_step_vol(struct mixer *m, struct mix_dev *dev, float dl, float dr)
+{
+	int c, l, r, nl, nr, v, i;
+
+	if (dev == NULL || dl < -MIX_VOLMAX || dl > MIX_VOLMAX ||
+	    dr < -MIX_VOLMAX || dr > MIX_VOLMAX) {
+		errno = dev == NULL ? EINVAL : ERANGE;
+		return (-1);
+	}
+	/* MIX_VOLDENORM() only rounds non-negative values correctly. */
+	l = dl < 0 ? -MIX_VOLDENORM(-dl) : MIX_VOLDENORM(dl);
+	r = dr < 0 ? -MIX_VOLDENORM(-dr) : MIX_VOLDENORM(dr);
+
+	v = dev->devno | (l & 0xff) << 8 | (r & 0xff) << 16;
+	if (_mixer_ioctl(m, MIXER_WRITE(SOUND_MIXER_STEP), &v) == 0) {
+		dev->vol.left = MIX_VOLNORM(v & 0x00ff);
+		dev->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+		_mixer_shstore(m, dev->devno, v);
+		return (0);
+	}
+	/* Anything but "not supported" is a real error. */
+	if (errno != ENXIO && errno != EINVAL && errno != ENOTTY)
+		return (-1);
+
+	for (i = 0; i < STEP_RETRIES; i++) {
+		if ((c = _mixer_counter(m)) < 0) {
+			errno = EOPNOTSUPP;
+			return (-1);
+		}
+		if (_mixer_ioctl(m, MIXER_READ(dev->devno), &v) < 0)
+			return (-1);
+		nl = l + (v & 0x00ff);
+		if (nl < 0)
+			nl = 0;
+		else if (nl > 100)
+			nl = 100;
+		nr = r + ((v >> 8) & 0x00ff);
+		if (nr < 0)
+			nr = 0;
+		else if (nr > 100)
+			nr = 100;
+		/* Someone else wrote since we read: start over. */
+		if (_mixer_counter(m) != c)
+			continue;
+		v = nl | nr << 8;
+		if (_mixer_ioctl(m, MIXER_WRITE(dev->devno), &v) < 0)
+			return (-1);
+		break;
+	}
+	if (i == STEP_RETRIES) {
+		errno = EAGAIN;
+		return (-1);
+	}
+	if (_mixer_readvol(m, dev) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Apply a mute option to the devices in `mask`.
+ */
+static int
+_mixer_modmute(int *v, int mask, int opt)
 {
 	switch (opt) {
 	case MIX_MUTE:
-		m->mutemask |= (1 << m->dev->devno);
+		*v |= mask;
 		break;
 	case MIX_UNMUTE:
-		m->mutemask &= ~(1 << m->dev->devno);
+		*v &= ~mask;
 		break;
 	case MIX_TOGGLEMUTE:
-		m->mutemask ^= (1 << m->dev->devno);
+		*v ^= mask;
+		break;
+	case MIX_SETMUTE:
+		*v = mask;
 		break;
 	default:
 		errno = EINVAL;
 		return (-1);
 	}
-	if (ioctl(m->fd, SOUND_MIXER_WRITE_MUTE, &m->mutemask) < 0)
+
+	return (0);
+}
+
+/*
+ * Apply a recording source option to the devices in `mask`.
+ */
+static int
+_mixer_modrecsrc(int *v, int mask, int opt)
+{
+	switch (opt) {
+	case MIX_ADDRECSRC:
+		*v |= mask;
+		break;
+	case MIX_REMOVERECSRC:
+		*v &= ~mask;
+		break;
+	case MIX_SETRECSRC:
+		*v = mask;
+		break;
+	case MIX_TOGGLERECSRC:
+		*v ^= mask;
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Manipulate a device's mute.
+ *
+ * @param opt		MIX_MUTE mute device
+ *			MIX_UNMUTE unmute device
+ *			MIX_TOGGLEMUTE toggle device's mute
+ */
+int
+mixer_set_mute(struct mixer *m, int opt)
+{
+	return (mixer_set_mutemask(m, 1 << m->dev->devno, opt));
+}
+
+/*
+ * Manipulate the mute of several devices at once. All changes reach the
+ * device in a single write, so no intermediate state is ever applied.
+ *
+ * @param mask		devices to operate on
+ * @param opt		MIX_MUTE mute devices
+ *			MIX_UNMUTE unmute devices
+ *			MIX_TOGGLEMUTE toggle devices' mute
+ *			MIX_SETMUTE mute exactly the devices in `mask`
+ */
+int
+mixer_set_mutemask(struct mixer *m, int mask, int opt)
+{
+	int v;
+
+	if (mask & ~m->devmask) {
+		errno = EINVAL;
+		return (-1);
+	}
+	_mixer_shload(m);
+	v = m->mutemask;
+	if (_mixer_modmute(&v, mask, opt) < 0)
+		return (-1);
+	if (_mixer_ioctl(m, SOUND_MIXER_WRITE_MUTE, &v) < 0)
 		return (-1);
-	if (ioctl(m->fd, SOUND_MIXER_READ_MUTE, &m->mutemask) < 0)
+	if (_mixer_ioctl(m, SOUND_MIXER_READ_MUTE, &m->mutemask) < 0)
 		return (-1);
+	_mixer_shstore(m, SOUND_MIXER_MUTE, m->mutemask);
 
-	return 0;
+	return (0);
 }
 
 /*
@@ -386,31 +1462,37 @@ mixer_set_mute(struct mixer *m, int opt)
 int
 mixer_mod_recsrc(struct mixer *m, int opt)
 {
-	if (!m->recmask || !MIX_ISREC(m, m->dev->devno)) {
+	return (mixer_set_recsrcmask(m, 1 << m->dev->devno, opt));
+}
+
+/*
+ * Modify several recording sources at once. Every device in `mask` has to be
+ * a recording device, otherwise the function will fail.
+ *
+ * @param mask		devices to operate on
+ * @param opt		MIX_ADDRECSRC add devices to recording sources
+ *			MIX_REMOVERECSRC remove devices from recording sources
+ *			MIX_SETRECSRC set devices as the only recording sources
+ *			MIX_TOGGLERECSRC toggle devices from recording sources
+ */
+int
+mixer_set_recsrcmask(struct mixer *m, int mask, int opt)
+{
+	int v;
+
+	if (!m->recmask || (mask & ~m->recmask)) {
 		errno = ENODEV;
 		return (-1);
 	}
-	switch (opt) {
-	case MIX_ADDRECSRC:
-		m->recsrc |= (1 << m->dev->devno);
-		break;
-	case MIX_REMOVERECSRC:
-		m->recsrc &= ~(1 << m->dev->devno);
-		break;
-	case MIX_SETRECSRC:
-		m->recsrc = (1 << m->dev->devno);
-		break;
-	case MIX_TOGGLERECSRC:
-		m->recsrc ^= (1 << m->dev->devno);
-		break;
-	default:
-		errno = EINVAL;
+	_mixer_shload(m);
+	v = m->recsrc;
+	if (_mixer_modrecsrc(&v, mask, opt) < 0)
 		return (-1);
-	}
-	if (ioctl(m->fd, SOUND_MIXER_WRITE_RECSRC, &m->recsrc) < 0)
+	if (_mixer_ioctl(m, SOUND_MIXER_WRITE_RECSRC, &v) < 0)
 		return (-1);
-	if (ioctl(m->fd, SOUND_MIXER_READ_RECSRC, &m->recsrc) < 0)
+	if (_mixer_ioctl(m, SOUND_MIXER_READ_RECSRC, &m->recsrc) < 0)
 		return (-1);
+	_mixer_shstore(m, SOUND_MIXER_RECSRC, m->recsrc);
 
 	return (0);
 }
@@ -426,7 +1508,7 @@ mixer_get_dunit(void)
 	int unit;
 
 	size = sizeof(int);
-	if (sysctlbyname("hw.snd.default_unit", &unit, &size, NULL, 0) < 0)
+	if (_mixer_sysctl("hw.snd.default_unit", &unit, &size, NULL, 0) < 0)
 		return (-1);
 
 	return (unit);
@@ -445,7 +1527,7 @@ mixer_set_dunit(struct mixer *m, int unit)
 	size_t size;
 
 	size = sizeof(int);
-	if (sysctlbyname("hw.snd.default_unit", NULL, 0, &unit, size) < 0)
+	if (_mixer_sysctl("hw.snd.default_unit", NULL, 0, &unit, size) < 0)
 		return (-1);
 	/* XXX: how will other mixers get updated? */
 	m->f_default = m->unit == unit;
@@ -466,7 +1548,7 @@ mixer_get_mode(int unit)
 
 	(void)snprintf(buf, sizeof(buf), "dev.pcm.%d.mode", unit);
 	size = sizeof(unsigned int);
-	if (sysctlbyname(buf, &mode, &size, NULL, 0) < 0)
+	if (_mixer_sysctl(buf, &mode, &size, NULL, 0) < 0)
 		return (0);
 
 	return (mode);
@@ -487,7 +1569,7 @@ mixer_get_nmixers(void)
 	 */
 	if ((m = mixer_open(NULL)) == NULL)
 		return (-1);
-	if (ioctl(m->fd, OSS_SYSINFO, &si) < 0) {
+	if (_mixer_ioctl(m, OSS_SYSINFO, &si) < 0) {
 		(void)mixer_close(m);
 		return (-1);
 	}
@@ -495,3 +1577,340 @@ mixer_get_nmixers(void)
 
 	return (si.nummixers);
 }
+
+
+/*
+ * Set up the operation queues and the completion pipe. This is done lazily,
+ * so that synchronous-only users pay nothing; the workers are only started
+ * once there is work for their device.
+ */
+static int
+_mixer_async_init(struct mixer *m)
+{
+	struct mix_async *a;
+	int i;
+
+	if ((a = calloc(1, sizeof(struct mix_async))) == NULL)
+		return (-1);
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
+		TAILQ_INIT(&a->q[i].pending);
+		(void)pthread_cond_init(&a->q[i].cv, NULL);
+		a->q[i].m = m;
+	}
+	TAILQ_INIT(&a->done);
+	if (pipe2(a->fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+		for (i = 0; i < SOUND_MIXER_NRDEVICES; i++)
+			(void)pthread_cond_destroy(&a->q[i].cv);
+		free(a);
+		return (-1);
+	}
+	(void)pthread_mutex_init(&a->mtx, NULL);
+	(void)pthread_mutex_init(&a->maskmtx, NULL);
+	m->async = a;
+
+	return (0);
+}
+
+/*
+ * Stop the workers and release the queues. Operations that have not been
+ * executed or reaped yet are dropped; the caller still owns their memory.
+ */
+static void
+_mixer_async_fini(struct mixer *m)
+{
+	struct mix_async *a = m->async;
+	int i;
+
+	pthread_mutex_lock(&a->mtx);
+	a->quit = 1;
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++)
+		pthread_cond_signal(&a->q[i].cv);
+	pthread_mutex_unlock(&a->mtx);
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
+		if (a->q[i].started)
+			(void)pthread_join(a->q[i].thr, NULL);
+		(void)pthread_cond_destroy(&a->q[i].cv);
+	}
+
+	(void)pthread_mutex_destroy(&a->maskmtx);
+	(void)pthread_mutex_destroy(&a->mtx);
+	(void)close(a->fds[0]);
+	(void)close(a->fds[1]);
+	free(a);
+	m->async = NULL;
+}
+
+/*
+ * Run a single operation. The worker only talks to the device and stores
+ * the results in the operation itself; the cached state in the mixer
+ * structure is updated by `mixer_complete`, in the caller's thread.
+ */
+static void
+_mixer_async_exec(struct mixer *m, mix_op_t *op)
+{
+	struct mix_async *a = m->async;
+	int v;
+
+	switch (op->type) {
+	case MIX_OP_SETVOL:
+		v = MIX_VOLDENORM(op->vol.left) |
+		    MIX_VOLDENORM(op->vol.right) << 8;
+		if (_mixer_ioctl(m, MIXER_WRITE(op->devno), &v) < 0 ||
+		    _mixer_ioctl(m, MIXER_READ(op->devno), &v) < 0)
+			goto fail;
+		op->vol.left = MIX_VOLNORM(v & 0x00ff);
+		op->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+		break;
+	case MIX_OP_SETMUTE:
+		/*
+		 * The workers of other devices may be changing the mask at
+		 * the same time, so start from the device's view rather than
+		 * the cached one, and let them in only once the mask is
+		 * written.
+		 */
+		pthread_mutex_lock(&a->maskmtx);
+		if (_mixer_ioctl(m, SOUND_MIXER_READ_MUTE, &v) < 0)
+			goto unlock;
+		(void)_mixer_modmute(&v, 1 << op->devno, op->opt);
+		if (_mixer_ioctl(m, SOUND_MIXER_WRITE_MUTE, &v) < 0 ||
+		    _mixer_ioctl(m, SOUND_MIXER_READ_MUTE, &v) < 0)
+			goto unlock;
+		pthread_mutex_unlock(&a->maskmtx);
+		op->mask = v;
+		break;
+	case MIX_OP_MODRECSRC:
+		pthread_mutex_lock(&a->maskmtx);
+		if (_mixer_ioctl(m, SOUND_MIXER_READ_RECSRC, &v) < 0)
+			goto unlock;
+		(void)_mixer_modrecsrc(&v, 1 << op->devno, op->opt);
+		if (_mixer_ioctl(m, SOUND_MIXER_WRITE_RECSRC, &v) < 0 ||
+		    _mixer_ioctl(m, SOUND_MIXER_READ_RECSRC, &v) < 0)
+			goto unlock;
+		pthread_mutex_unlock(&a->maskmtx);
+		op->mask = v;
+		break;
+	}
+	op->error = 0;
+
+	return;
+unlock:
+	op->error = errno;
+	pthread_mutex_unlock(&a->maskmtx);
+
+	return;
+fail:
+	op->error = errno;
+}
+
+static void *
+_mixer_async_worker(void *arg)
+{
+	struct mix_asyncq *q = arg;
+	struct mix_async *a = q->m->async;
+	mix_op_t *op;
+	char c = 0;
+
+	pthread_mutex_lock(&a->mtx);
+	for (;;) {
+		while (!a->quit && TAILQ_EMPTY(&q->pending))
+			pthread_cond_wait(&q->cv, &a->mtx);
+		if (a->quit)
+			break;
+		op = TAILQ_FIRST(&q->pending);
+		TAILQ_REMOVE(&q->pending, op, ops);
+		pthread_mutex_unlock(&a->mtx);
+
+		_mixer_async_exec(q->m, op);
+
+		pthread_mutex_lock(&a->mtx);
+		TAILQ_INSERT_TAIL(&a->done, op, ops);
+		/*
+		 * A full pipe is still readable, so a failed write does not
+		 * lose the wakeup.
+		 */
+		(void)write(a->fds[1], &c, 1);
+	}
+	pthread_mutex_unlock(&a->mtx);
+
+	return (NULL);
+}
+
+/*
+ * Queue an operation for asynchronous execution. Every device of the mixer
+ * has a worker thread of its own, which executes the operations submitted
+ * for that device one at a time, in submission order. Operations on
+ * different devices, or on different mixers, proceed in parallel and may
+ * complete in any order. The caller owns `op` and must not touch it until
+ * it is returned by `mixer_complete`.
+ *
+ * Before submitting, the caller fills in `type`, `devno` and, depending on
+ * the type, `vol` (MIX_OP_SETVOL) or `opt` (MIX_OP_SETMUTE and
+ * MIX_OP_MODRECSRC, same values as in `mixer_set_mute` and
+ * `mixer_mod_recsrc`).
+ */
+int
+mixer_submit(struct mixer *m, mix_op_t *op)
+{
+	struct mix_async *a;
+	struct mix_asyncq *q;
+	int e, v = 0;
+
+	if (op == NULL || op->devno < 0 ||
+	    op->devno >= SOUND_MIXER_NRDEVICES || !MIX_ISDEV(m, op->devno)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	switch (op->type) {
+	case MIX_OP_SETVOL:
+		if (op->vol.left < MIX_VOLMIN || op->vol.left > MIX_VOLMAX ||
+		    op->vol.right < MIX_VOLMIN || op->vol.right > MIX_VOLMAX) {
+			errno = ERANGE;
+			return (-1);
+		}
+		break;
+	case MIX_OP_SETMUTE:
+		if (_mixer_modmute(&v, 0, op->opt) < 0)
+			return (-1);
+		break;
+	case MIX_OP_MODRECSRC:
+		if (!m->recmask || !MIX_ISREC(m, op->devno)) {
+			errno = ENODEV;
+			return (-1);
+		}
+		if (_mixer_modrecsrc(&v, 0, op->opt) < 0)
+			return (-1);
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	if (m->async == NULL && _mixer_async_init(m) < 0)
+		return (-1);
+	a = m->async;
+	q = &a->q[op->devno];
+	op->error = EINPROGRESS;
+	pthread_mutex_lock(&a->mtx);
+	if (!q->started) {
+		if ((e = pthread_create(&q->thr, NULL, _mixer_async_worker,
+		    q)) != 0) {
+			pthread_mutex_unlock(&a->mtx);
+			errno = e;
+			return (-1);
+		}
+		q->started = 1;
+	}
+	TAILQ_INSERT_TAIL(&q->pending, op, ops);
+	pthread_cond_signal(&q->cv);
+	pthread_mutex_unlock(&a->mtx);
+
+	return (0);
+}
+
+/*
+ * Cancel a submitted operation. Only operations that have not started
+ * executing can be cancelled; they complete with `error` set to ECANCELED
+ * and still have to be reaped with `mixer_complete`.
+ */
+int
+mixer_cancel(struct mixer *m, mix_op_t *op)
+{
+	struct mix_async *a = m->async;
+	struct mix_asyncq *q;
+	mix_op_t *p;
+	char c = 0;
+
+	if (a == NULL || op == NULL || op->devno < 0 ||
+	    op->devno >= SOUND_MIXER_NRDEVICES) {
+		errno = EINVAL;
+		return (-1);
+	}
+	q = &a->q[op->devno];
+	pthread_mutex_lock(&a->mtx);
+	TAILQ_FOREACH(p, &q->pending, ops) {
+		if (p == op)
+			break;
+	}
+	if (p == NULL) {
+		pthread_mutex_unlock(&a->mtx);
+		errno = EBUSY;
+		return (-1);
+	}
+	TAILQ_REMOVE(&q->pending, op, ops);
+	op->error = ECANCELED;
+	TAILQ_INSERT_TAIL(&a->done, op, ops);
+	(void)write(a->fds[1], &c, 1);
+	pthread_mutex_unlock(&a->mtx);
+
+	return (0);
+}
+
+/*
+ * Reap a completed operation, if any. On success, the results are also
+ * stored in the mixer structure, so that the cached volumes and masks stay
+ * the same as with the synchronous functions. Returns NULL and sets `errno`
+ * to EAGAIN if nothing has completed yet.
+ */
+mix_op_t *
+mixer_complete(struct mixer *m)
+{
+	struct mix_async *a = m->async;
+	struct mix_dev *dp;
+	mix_op_t *op;
+	char buf[64];
+
+	if (a == NULL) {
+		errno = EAGAIN;
+		return (NULL);
+	}
+	pthread_mutex_lock(&a->mtx);
+	if ((op = TAILQ_FIRST(&a->done)) != NULL)
+		TAILQ_REMOVE(&a->done, op, ops);
+	/* Clear the descriptor only when there is nothing left to reap. */
+	if (TAILQ_EMPTY(&a->done))
+		while (read(a->fds[0], buf, sizeof(buf)) > 0)
+			;
+	pthread_mutex_unlock(&a->mtx);
+	if (op == NULL) {
+		errno = EAGAIN;
+		return (NULL);
+	}
+	if (op->error != 0)
+		return (op);
+
+	switch (op->type) {
+	case MIX_OP_SETVOL:
+		TAILQ_FOREACH(dp, &m->devs, devs) {
+			if (dp->devno == op->devno) {
+				dp->vol = op->vol;
+				break;
+			}
+		}
+		_mixer_shstore(m, op->devno, MIX_VOLDENORM(op->vol.left) |
+		    MIX_VOLDENORM(op->vol.right) << 8);
+		break;
+	case MIX_OP_SETMUTE:
+		m->mutemask = op->mask;
+		_mixer_shstore(m, SOUND_MIXER_MUTE, op->mask);
+		break;
+	case MIX_OP_MODRECSRC:
+		m->recsrc = op->mask;
+		_mixer_shstore(m, SOUND_MIXER_RECSRC, op->mask);
+		break;
+	}
+
+	return (op);
+}
+
+/*
+ * Get the completion descriptor. It becomes readable whenever there are
+ * completed operations waiting for `mixer_complete`, so it can be added to
+ * an existing poll(2), select(2) or kqueue(2) loop.
+ */
+int
+mixer_get_compfd(struct mixer *m)
+{
+	if (m->async == NULL && _mixer_async_init(m) < 0)
+		return (-1);
+
+	return (m->async->fds[0]);
+}
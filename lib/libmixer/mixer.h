@@ -26,6 +26,7 @@
 #define _MIXER_H_
 
 #include <sys/cdefs.h>
+#include <sys/types.h>
 #include <sys/queue.h>
 #include <sys/soundcard.h>
 
@@ -40,23 +41,46 @@
 /* Forward declarations */
 struct mixer;
 struct mix_dev;
+struct mix_async;
+struct mix_name;
+struct mix_ctlpool;
+struct mix_meter;
+struct mix_coalesce;
+struct mix_stream;
+struct mix_preset;
+struct mix_group;
+struct mix_hotplug;
+struct mix_share;
 
 typedef struct mix_ctl mix_ctl_t;
 typedef struct mix_volume mix_volume_t;
+typedef union mix_ctlval mix_ctlval_t;
+typedef struct mix_op mix_op_t;
+
+/* Value types of user-defined controls */
+struct mix_ctltype {
+#define MIX_CTL_VOLUME		1	/* left and right volume */
+#define MIX_CTL_BOOL		2	/* 0 or 1 */
+#define MIX_CTL_ENUM		3	/* index into `items` */
+#define MIX_CTL_RANGE		4	/* integer from `min` to `max` */
+	int type;
+	int min;				/* MIX_CTL_RANGE bounds */
+	int max;
+	int nitems;				/* MIX_CTL_ENUM items */
+	const char *const *items;
+};
 
 /* User-defined controls */
 struct mix_ctl {
-	struct mix_dev *parent_dev;		/* parent device */
 	int id;					/* control id */
-	char name[NAME_MAX];			/* control name */
 	int (*mod)(struct mix_dev *, void *);	/* modify control values */
 	int (*print)(struct mix_dev *, void *);	/* print control */
+	struct mix_dev *parent_dev;		/* parent device */
+	const char *name;			/* control name */
 	TAILQ_ENTRY(mix_ctl) ctls;
 };
 
 struct mix_dev {
-	struct mixer *parent_mixer;		/* parent mixer */
-	char name[NAME_MAX];			/* device name (e.g "vol") */
 	int devno;				/* device number */
 	struct mix_volume {
 #define MIX_VOLMIN		0.0f
@@ -67,10 +91,26 @@ struct mix_dev {
 		float right;			/* right volume */
 	} vol;
 	int nctl;				/* number of controls */
+	struct mixer *parent_mixer;		/* parent mixer */
+	const char *name;			/* device name (e.g "vol") */
 	TAILQ_HEAD(mix_ctlhead, mix_ctl) ctls;	/* control list */
 	TAILQ_ENTRY(mix_dev) devs;
 };
 
+union mix_ctlval {
+	mix_volume_t vol;			/* MIX_CTL_VOLUME */
+	int b;					/* MIX_CTL_BOOL */
+	int e;					/* MIX_CTL_ENUM */
+	int i;					/* MIX_CTL_RANGE */
+};
+
+/* Request for `mixer_ctl_get_many` and `mixer_ctl_set_many` */
+struct mix_ctlreq {
+	mix_ctl_t *ctl;				/* control */
+	mix_ctlval_t val;			/* value to set, or read */
+	int error;				/* 0, or errno on failure */
+};
+
 struct mixer {
 	TAILQ_HEAD(mix_devhead, mix_dev) devs;	/* device list */
 	struct mix_dev *dev;			/* selected device */
@@ -84,6 +124,7 @@ struct mixer {
 #define MIX_MUTE		0x01
 #define MIX_UNMUTE		0x02
 #define MIX_TOGGLEMUTE		0x04
+#define MIX_SETMUTE		0x08
 	int mutemask;				/* muted devices */
 	int recmask;				/* recording devices */
 #define MIX_ADDRECSRC		0x01
@@ -96,27 +137,159 @@ struct mixer {
 #define MIX_MODE_REC		0x04
 	int mode;				/* dev.pcm.X.mode sysctl */
 	int f_default;				/* default mixer flag */
+	struct mix_async *async;		/* asynchronous operation queue */
+	struct mix_name *names;			/* interned control names */
+	struct mix_ctlpool *ctlpool;		/* see mixer_open_into() */
+	struct mix_share *share;		/* see mixer_acquire() */
+};
+
+/* Longest control name, including the NUL, for mixer_open_into(). */
+#define MIX_CTLNAMELEN		32
+
+/* Asynchronous operations */
+struct mix_op {
+#define MIX_OP_SETVOL		0x01
+#define MIX_OP_SETMUTE		0x02
+#define MIX_OP_MODRECSRC	0x03
+	int type;				/* operation type */
+	int devno;				/* target device number */
+	int opt;				/* MIX_MUTE, MIX_ADDRECSRC, ... */
+	mix_volume_t vol;			/* volume to set, then read back */
+	int mask;				/* resulting mute/recsrc mask */
+	int error;				/* 0 on success, errno on failure */
+	void *udata;				/* caller data */
+	TAILQ_ENTRY(mix_op) ops;
+};
+
+/* Level metering */
+#define MIX_METER_MAXCHAN	8
+struct mix_level {
+	float peak;				/* peak, 1.0 is full scale */
+	float rms;				/* RMS, 1.0 is full scale */
+	unsigned int clips;			/* samples at full scale */
+};
+
+/* Coalesced volume updates */
+struct mix_coalesce_stats {
+	unsigned long merged;			/* replaced while pending */
+	unsigned long dropped;			/* same levels as the device */
+	unsigned long issued;			/* written to the device */
+};
+
+/* Presets */
+struct mix_preset_ent {
+	const char *dev;			/* device name (e.g "vol") */
+#define MIX_PRESET_VOL		0x01
+#define MIX_PRESET_MUTE		0x02
+#define MIX_PRESET_RECSRC	0x04
+	int flags;				/* fields that are set */
+	mix_volume_t vol;			/* volume */
+	int mute;				/* 0 or 1 */
+	int recsrc;				/* 0 or 1 */
+};
+
+/* Hotplug events */
+struct mix_hpevent {
+#define MIX_HP_ATTACH		0x01
+#define MIX_HP_DETACH		0x02
+	int type;				/* event type */
+	int unit;				/* audio card unit */
+};
+
+struct mix_hpsource {
+	int (*getfd)(void *);			/* descriptor to poll */
+	int (*next)(void *, struct mix_hpevent *); /* 1 if event, 0 if none */
+	void (*close)(void *);			/* release the source */
+	void *arg;				/* passed to all of the above */
 };
 
 __BEGIN_DECLS
 
 struct mixer *mixer_open(const char *);
+struct mixer *mixer_open_into(void *, size_t, const char *);
+size_t mixer_open_size(int);
 int mixer_close(struct mixer *);
+struct mixer *mixer_acquire(int);
+int mixer_release(struct mixer *);
+int mixer_refresh(struct mixer *);
 struct mix_dev *mixer_get_dev(struct mixer *, int);
 struct mix_dev *mixer_get_dev_byname(struct mixer *, const char *);
+const char *mixer_dev_name(const struct mix_dev *);
+int mixer_dev_devno(const struct mix_dev *);
+mix_volume_t mixer_dev_vol(const struct mix_dev *);
+struct mix_dev *mixer_dev_next(struct mixer *, struct mix_dev *);
 int mixer_add_ctl(struct mix_dev *, int, const char *,
     int (*)(struct mix_dev *, void *), int (*)(struct mix_dev *, void *));
 int mixer_add_ctl_s(mix_ctl_t *);
+int mixer_add_ctl_typed(struct mix_dev *, int, const char *,
+    const struct mix_ctltype *, int (*)(struct mix_dev *, mix_ctlval_t *),
+    int (*)(struct mix_dev *, const mix_ctlval_t *));
 int mixer_remove_ctl(mix_ctl_t *);
 mix_ctl_t *mixer_get_ctl(struct mix_dev *, int);
 mix_ctl_t *mixer_get_ctl_byname(struct mix_dev *, const char *);
+const char *mixer_ctl_name(const mix_ctl_t *);
+int mixer_ctl_id(const mix_ctl_t *);
+mix_ctl_t *mixer_ctl_next(struct mix_dev *, mix_ctl_t *);
+int mixer_ctl_get(mix_ctl_t *, mix_ctlval_t *);
+int mixer_ctl_set(mix_ctl_t *, const mix_ctlval_t *);
+int mixer_ctl_get_many(struct mix_ctlreq *, int);
+int mixer_ctl_set_many(struct mix_ctlreq *, int);
 int mixer_set_vol(struct mixer *, mix_volume_t);
+int mixer_step_vol(struct mixer *, struct mix_dev *, float, float);
 int mixer_set_mute(struct mixer *, int);
 int mixer_mod_recsrc(struct mixer *, int);
+int mixer_set_mutemask(struct mixer *, int, int);
+int mixer_set_recsrcmask(struct mixer *, int, int);
 int mixer_get_dunit(void);
 int mixer_set_dunit(struct mixer *, int);
 int mixer_get_mode(int);
 int mixer_get_nmixers(void);
+int mixer_submit(struct mixer *, mix_op_t *);
+int mixer_cancel(struct mixer *, mix_op_t *);
+mix_op_t *mixer_complete(struct mixer *);
+int mixer_get_compfd(struct mixer *);
+struct mix_meter *mixer_meter_new(int, int, int, int, int);
+struct mix_meter *mixer_meter_open(const char *, int, int, int, int, int);
+int mixer_meter_feed(struct mix_meter *, const void *, size_t);
+int mixer_meter_read(struct mix_meter *);
+int mixer_meter_get(struct mix_meter *, struct mix_level *, int);
+int mixer_meter_getfd(struct mix_meter *);
+int mixer_meter_close(struct mix_meter *);
+struct mix_coalesce *mixer_coalesce_new(struct mixer *, int,
+    int64_t (*)(void *), void *);
+int mixer_coalesce_set_vol(struct mix_coalesce *, struct mix_dev *,
+    mix_volume_t);
+int mixer_coalesce_poll(struct mix_coalesce *);
+int mixer_coalesce_timeout(struct mix_coalesce *);
+int mixer_coalesce_flush(struct mix_coalesce *);
+void mixer_coalesce_stats(struct mix_coalesce *, struct mix_coalesce_stats *);
+void mixer_coalesce_free(struct mix_coalesce *);
+struct mix_stream *mixer_stream_new(int);
+int mixer_stream_get_vol(struct mix_stream *, mix_volume_t *);
+int mixer_stream_set_vol(struct mix_stream *, mix_volume_t);
+int mixer_stream_get_mute(struct mix_stream *);
+int mixer_stream_set_mute(struct mix_stream *, int);
+int mixer_stream_set_ramp(struct mix_stream *, int);
+void mixer_stream_free(struct mix_stream *);
+struct mix_preset *mixer_preset_compile(const struct mix_preset_ent *, int);
+struct mix_preset *mixer_preset_capture(struct mixer *);
+int mixer_preset_apply(struct mixer *, const struct mix_preset *);
+void mixer_preset_free(struct mix_preset *);
+struct mix_group *mixer_group_open(const int *, int);
+int mixer_group_count(struct mix_group *);
+struct mixer *mixer_group_get(struct mix_group *, int);
+int mixer_group_unit(struct mix_group *, int);
+int mixer_group_apply(struct mix_group *, int (*)(struct mixer *, int, void *),
+    void *, int *);
+int mixer_group_close(struct mix_group *);
+struct mix_hotplug *mixer_hotplug_new(const struct mix_hpsource *,
+    void (*)(struct mixer *, int, void *), void *);
+int mixer_hotplug_getfd(struct mix_hotplug *);
+int mixer_hotplug_dispatch(struct mix_hotplug *);
+struct mixer *mixer_hotplug_get(struct mix_hotplug *, int);
+int mixer_hotplug_set_preset(struct mix_hotplug *, const char *,
+    struct mix_preset *);
+void mixer_hotplug_free(struct mix_hotplug *);
 
 __END_DECLS
 
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Coalescing of volume updates.
+ *
+ * Updates only replace the pending volume of their device. Pending volumes
+ * are written out at most `maxrate` times per second, or when the caller
+ * asks for it, and only if they differ from the device's volume once
+ * quantized to the 0-100 range the driver works with.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mixer.h"
+
+struct mix_coalesce {
+	struct mixer *m;
+	int64_t period;				/* usec between flushes, or 0 */
+	int64_t last;				/* time of the last flush */
+	int64_t (*clock)(void *);		/* time source, in usec */
+	void *clockarg;
+	int pending;				/* devices with a pending volume */
+	mix_volume_t vol[SOUND_MIXER_NRDEVICES];
+	struct mix_coalesce_stats st;
+};
+
+static int64_t _coalesce_clock(void *);
+
+static int64_t
+_coalesce_clock(void *arg __unused)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*
+ * Create a coalescing queue for `m`.
+ *
+ * @param maxrate	most flushes per second; 0 to only flush on
+ *			`mixer_coalesce_flush`.
+ * @param clock		time source returning microseconds, called with
+ *			`clockarg`; NULL for CLOCK_MONOTONIC.
+ */
+struct mix_coalesce *
+mixer_coalesce_new(struct mixer *m, int maxrate, int64_t (*clock)(void *),
+    void *clockarg)
+{
+	struct mix_coalesce *c;
+
+	if (m == NULL || maxrate < 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((c = calloc(1, sizeof(struct mix_coalesce))) == NULL)
+		return (NULL);
+	c->m = m;
+	c->period = maxrate > 0 ? 1000000 / maxrate : 0;
+	c->clock = clock != NULL ? clock : _coalesce_clock;
+	c->clockarg = clockarg;
+	/* Let the first update through right away. */
+	c->last = c->clock(c->clockarg) - c->period;
+
+	return (c);
+}
+
+/*
+ * Queue a new volume for `dev`, replacing any pending one, and flush if the
+ * rate allows it.
+ */
+int
+mixer_coalesce_set_vol(struct mix_coalesce *c, struct mix_dev *dev,
+    mix_volume_t vol)
+{
+	if (dev == NULL || dev->parent_mixer != c->m) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (vol.left < MIX_VOLMIN || vol.left > MIX_VOLMAX ||
+	    vol.right < MIX_VOLMIN || vol.right > MIX_VOLMAX) {
+		errno = ERANGE;
+		return (-1);
+	}
+	if (MIX_ISSET(dev->devno, c->pending))
+		c->st.merged++;
+	c->pending |= 1 << dev->devno;
+	c->vol[dev->devno] = vol;
+
+	return (mixer_coalesce_poll(c));
+}
+
+/*
+ * Flush if there is something pending and the last flush is at least one
+ * period old. This has to be called every so often by callers that stop
+ * sending updates, so that the last one gets written; see
+ * `mixer_coalesce_timeout`.
+ */
+int
+mixer_coalesce_poll(struct mix_coalesce *c)
+{
+	if (c->pending == 0 || c->period == 0 ||
+	    c->clock(c->clockarg) - c->last < c->period)
+		return (0);
+
+	return (mixer_coalesce_flush(c));
+}
+
+/*
+ * Return the number of milliseconds until a flush is due, 0 if it is due
+ * already, or -1 if there is nothing to flush. Meant as a poll(2) timeout.
+ */
+int
+mixer_coalesce_timeout(struct mix_coalesce *c)
+{
+	int64_t left;
+
+	if (c->pending == 0 || c->period == 0)
+		return (-1);
+	left = c->last + c->period - c->clock(c->clockarg);
+
+	return (left <= 0 ? 0 : (int)((left + 999) / 1000));
+}
+
+/*
+ * Write out all pending volumes now. Volumes that quantize to the device's
+ * current levels are dropped without touching the device. A volume that
+ * cannot be written stays pending, for the next flush to try again.
+ *
+ * Returns the number of writes issued, or -1 if any of them failed.
+ */
+int
+mixer_coalesce_flush(struct mix_coalesce *c)
+{
+	struct mixer *m = c->m;
+	struct mix_dev *dp, *sel;
+	mix_volume_t *v;
+	int n = 0, e = 0, failed = 0;
+
+	c->last = c->clock(c->clockarg);
+	if (c->pending == 0)
+		return (0);
+	sel = m->dev;
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		if (!MIX_ISSET(dp->devno, c->pending))
+			continue;
+		v = &c->vol[dp->devno];
+		if (MIX_VOLDENORM(v->left) == MIX_VOLDENORM(dp->vol.left) &&
+		    MIX_VOLDENORM(v->right) == MIX_VOLDENORM(dp->vol.right)) {
+			c->st.dropped++;
+			continue;
+		}
+		m->dev = dp;
+		c->st.issued++;
+		n++;
+		if (mixer_set_vol(m, *v) < 0) {
+			failed |= 1 << dp->devno;
+			if (e == 0)
+				e = errno;
+		}
+	}
+	m->dev = sel;
+	c->pending = failed;
+	if (e != 0) {
+		errno = e;
+		return (-1);
+	}
+
+	return (n);
+}
+
+/*
+ * Copy the counters of `c` to `st`.
+ */
+void
+mixer_coalesce_stats(struct mix_coalesce *c, struct mix_coalesce_stats *st)
+{
+	*st = c->st;
+}
+
+/*
+ * Free the queue. Pending volumes are discarded, so callers that want them
+ * written have to call `mixer_coalesce_flush` first.
+ */
+void
+mixer_coalesce_free(struct mix_coalesce *c)
+{
+	free(c);
+}
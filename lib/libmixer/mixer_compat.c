@@ -0,0 +1,434 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * FBSD_1.7 compatibility.
+ *
+ * mix_dev and mix_ctl used to carry their names in NAME_MAX arrays, and
+ * binaries linked against FBSD_1.7 reach into them directly. The functions
+ * below are the FBSD_1.7 ones, kept as they were and working on the old
+ * layout, so that those binaries go on running. They bind to the FBSD_1.7
+ * versions of the symbols; everything else links against FBSD_1.8.
+ *
+ * struct mixer only grew at the end and is allocated here, so the functions
+ * that do not look into devices or controls were left in FBSD_1.7.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mixer.h"
+
+#define	BASEPATH "/dev/mixer"
+
+struct freebsd17_mix_dev;
+
+struct freebsd17_mix_ctl {
+	struct freebsd17_mix_dev *parent_dev;
+	int id;
+	char name[NAME_MAX];
+	int (*mod)(struct freebsd17_mix_dev *, void *);
+	int (*print)(struct freebsd17_mix_dev *, void *);
+	TAILQ_ENTRY(freebsd17_mix_ctl) ctls;
+};
+
+struct freebsd17_mix_dev {
+	struct freebsd17_mixer *parent_mixer;
+	char name[NAME_MAX];
+	int devno;
+	mix_volume_t vol;
+	int nctl;
+	TAILQ_HEAD(, freebsd17_mix_ctl) ctls;
+	TAILQ_ENTRY(freebsd17_mix_dev) devs;
+};
+
+struct freebsd17_mixer {
+	TAILQ_HEAD(, freebsd17_mix_dev) devs;
+	struct freebsd17_mix_dev *dev;
+	oss_mixerinfo mi;
+	oss_card_info ci;
+	char name[NAME_MAX];
+	int fd;
+	int unit;
+	int ndev;
+	int devmask;
+	int mutemask;
+	int recmask;
+	int recsrc;
+	int mode;
+	int f_default;
+};
+
+typedef struct freebsd17_mixer mixer17_t;
+typedef struct freebsd17_mix_dev mix_dev17_t;
+typedef struct freebsd17_mix_ctl mix_ctl17_t;
+
+mixer17_t *freebsd17_mixer_open(const char *);
+int freebsd17_mixer_close(mixer17_t *);
+mix_dev17_t *freebsd17_mixer_get_dev(mixer17_t *, int);
+mix_dev17_t *freebsd17_mixer_get_dev_byname(mixer17_t *, const char *);
+int freebsd17_mixer_add_ctl(mix_dev17_t *, int, const char *,
+    int (*)(mix_dev17_t *, void *), int (*)(mix_dev17_t *, void *));
+int freebsd17_mixer_add_ctl_s(mix_ctl17_t *);
+int freebsd17_mixer_remove_ctl(mix_ctl17_t *);
+mix_ctl17_t *freebsd17_mixer_get_ctl(mix_dev17_t *, int);
+mix_ctl17_t *freebsd17_mixer_get_ctl_byname(mix_dev17_t *, const char *);
+int freebsd17_mixer_set_vol(mixer17_t *, mix_volume_t);
+int freebsd17_mixer_set_mute(mixer17_t *, int);
+int freebsd17_mixer_mod_recsrc(mixer17_t *, int);
+
+static int _compat_readvol(mixer17_t *, mix_dev17_t *);
+
+static int
+_compat_readvol(mixer17_t *m, mix_dev17_t *dev)
+{
+	int v;
+
+	if (ioctl(m->fd, MIXER_READ(dev->devno), &v) < 0)
+		return (-1);
+	dev->vol.left = MIX_VOLNORM(v & 0x00ff);
+	dev->vol.right = MIX_VOLNORM((v >> 8) & 0x00ff);
+
+	return (0);
+}
+
+mixer17_t *
+freebsd17_mixer_open(const char *name)
+{
+	mixer17_t *m = NULL;
+	mix_dev17_t *dp;
+	const char *names[SOUND_MIXER_NRDEVICES] = SOUND_DEVICE_NAMES;
+	int i;
+
+	if ((m = calloc(1, sizeof(mixer17_t))) == NULL)
+		goto fail;
+
+	if (name != NULL) {
+		/* `name` does not start with "/dev/mixer". */
+		if (strncmp(name, BASEPATH, strlen(BASEPATH)) != 0) {
+			m->unit = -1;
+		} else {
+			/* `name` is "/dev/mixer", use the default unit. */
+			if (strncmp(name, BASEPATH, strlen(name)) == 0)
+				goto dunit;
+			m->unit = strtol(name + strlen(BASEPATH), NULL, 10);
+		}
+		(void)strlcpy(m->name, name, sizeof(m->name));
+	} else {
+dunit:
+		if ((m->unit = mixer_get_dunit()) < 0)
+			goto fail;
+		(void)snprintf(m->name, sizeof(m->name), "/dev/mixer%d",
+		    m->unit);
+	}
+
+	if ((m->fd = open(m->name, O_RDWR)) < 0)
+		goto fail;
+
+	m->devmask = m->recmask = m->recsrc = 0;
+	m->f_default = m->unit == mixer_get_dunit();
+	m->mode = mixer_get_mode(m->unit);
+	/* The unit number _must_ be set before the ioctl. */
+	m->mi.dev = m->unit;
+	m->ci.card = m->unit;
+	if (ioctl(m->fd, SNDCTL_MIXERINFO, &m->mi) < 0) {
+		memset(&m->mi, 0, sizeof(m->mi));
+		strlcpy(m->mi.name, m->name, sizeof(m->mi.name));
+	}
+	if (ioctl(m->fd, SNDCTL_CARDINFO, &m->ci) < 0)
+		memset(&m->ci, 0, sizeof(m->ci));
+	if (ioctl(m->fd, SOUND_MIXER_READ_DEVMASK, &m->devmask) < 0 ||
+	    ioctl(m->fd, SOUND_MIXER_READ_MUTE, &m->mutemask) < 0 ||
+	    ioctl(m->fd, SOUND_MIXER_READ_RECMASK, &m->recmask) < 0 ||
+	    ioctl(m->fd, SOUND_MIXER_READ_RECSRC, &m->recsrc) < 0)
+		goto fail;
+
+	TAILQ_INIT(&m->devs);
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
+		if (!MIX_ISDEV(m, i))
+			continue;
+		if ((dp = calloc(1, sizeof(mix_dev17_t))) == NULL)
+			goto fail;
+		dp->parent_mixer = m;
+		dp->devno = i;
+		dp->nctl = 0;
+		if (_compat_readvol(m, dp) < 0)
+			goto fail;
+		(void)strlcpy(dp->name, names[i], sizeof(dp->name));
+		TAILQ_INIT(&dp->ctls);
+		TAILQ_INSERT_TAIL(&m->devs, dp, devs);
+		m->ndev++;
+	}
+
+	/* The default device is always "vol". */
+	m->dev = TAILQ_FIRST(&m->devs);
+
+	return (m);
+fail:
+	if (m != NULL)
+		(void)freebsd17_mixer_close(m);
+
+	return (NULL);
+}
+__sym_compat(mixer_open, freebsd17_mixer_open, FBSD_1.7);
+
+int
+freebsd17_mixer_close(mixer17_t *m)
+{
+	mix_dev17_t *dp;
+	int r;
+
+	r = close(m->fd);
+	while (!TAILQ_EMPTY(&m->devs)) {
+		dp = TAILQ_FIRST(&m->devs);
+		TAILQ_REMOVE(&m->devs, dp, devs);
+		while (!TAILQ_EMPTY(&dp->ctls)) {
+			(void)freebsd17_mixer_remove_ctl(
+			    TAILQ_FIRST(&dp->ctls));
+		}
+		free(dp);
+	}
+	free(m);
+
+	return (r);
+}
+__sym_compat(mixer_close, freebsd17_mixer_close, FBSD_1.7);
+
+mix_dev17_t *
+freebsd17_mixer_get_dev(mixer17_t *m, int dev)
+{
+	mix_dev17_t *dp;
+
+	if (dev < 0 || dev >= m->ndev) {
+		errno = ERANGE;
+		return (NULL);
+	}
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		if (dp->devno == dev)
+			return (dp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+__sym_compat(mixer_get_dev, freebsd17_mixer_get_dev, FBSD_1.7);
+
+mix_dev17_t *
+freebsd17_mixer_get_dev_byname(mixer17_t *m, const char *name)
+{
+	mix_dev17_t *dp;
+
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		if (!strncmp(dp->name, name, sizeof(dp->name)))
+			return (dp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+__sym_compat(mixer_get_dev_byname, freebsd17_mixer_get_dev_byname, FBSD_1.7);
+
+int
+freebsd17_mixer_add_ctl(mix_dev17_t *parent_dev, int id, const char *name,
+    int (*mod)(mix_dev17_t *, void *), int (*print)(mix_dev17_t *, void *))
+{
+	mix_dev17_t *dp;
+	mix_ctl17_t *ctl, *cp;
+
+	if (parent_dev == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((ctl = calloc(1, sizeof(mix_ctl17_t))) == NULL)
+		return (-1);
+	ctl->parent_dev = parent_dev;
+	ctl->id = id;
+	if (name != NULL)
+		(void)strlcpy(ctl->name, name, sizeof(ctl->name));
+	ctl->mod = mod;
+	ctl->print = print;
+	dp = ctl->parent_dev;
+	/* Make sure the same ID or name doesn't exist already. */
+	TAILQ_FOREACH(cp, &dp->ctls, ctls) {
+		if (!strncmp(cp->name, name, sizeof(cp->name)) ||
+		    cp->id == id) {
+			errno = EINVAL;
+			return (-1);
+		}
+	}
+	TAILQ_INSERT_TAIL(&dp->ctls, ctl, ctls);
+	dp->nctl++;
+
+	return (0);
+}
+__sym_compat(mixer_add_ctl, freebsd17_mixer_add_ctl, FBSD_1.7);
+
+int
+freebsd17_mixer_add_ctl_s(mix_ctl17_t *ctl)
+{
+	if (ctl == NULL)
+		return (-1);
+
+	return (freebsd17_mixer_add_ctl(ctl->parent_dev, ctl->id, ctl->name,
+	    ctl->mod, ctl->print));
+}
+__sym_compat(mixer_add_ctl_s, freebsd17_mixer_add_ctl_s, FBSD_1.7);
+
+int
+freebsd17_mixer_remove_ctl(mix_ctl17_t *ctl)
+{
+	mix_dev17_t *p;
+
+	if (ctl == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	p = ctl->parent_dev;
+	if (!TAILQ_EMPTY(&p->ctls)) {
+		TAILQ_REMOVE(&p->ctls, ctl, ctls);
+		free(ctl);
+	}
+
+	return (0);
+}
+__sym_compat(mixer_remove_ctl, freebsd17_mixer_remove_ctl, FBSD_1.7);
+
+mix_ctl17_t *
+freebsd17_mixer_get_ctl(mix_dev17_t *d, int id)
+{
+	mix_ctl17_t *cp;
+
+	TAILQ_FOREACH(cp, &d->ctls, ctls) {
+		if (cp->id == id)
+			return (cp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+__sym_compat(mixer_get_ctl, freebsd17_mixer_get_ctl, FBSD_1.7);
+
+mix_ctl17_t *
+freebsd17_mixer_get_ctl_byname(mix_dev17_t *d, const char *name)
+{
+	mix_ctl17_t *cp;
+
+	TAILQ_FOREACH(cp, &d->ctls, ctls) {
+		if (!strncmp(cp->name, name, sizeof(cp->name)))
+			return (cp);
+	}
+	errno = EINVAL;
+
+	return (NULL);
+}
+__sym_compat(mixer_get_ctl_byname, freebsd17_mixer_get_ctl_byname, FBSD_1.7);
+
+int
+freebsd17_mixer_set_vol(mixer17_t *m, mix_volume_t vol)
+{
+	int v;
+
+	if (vol.left < MIX_VOLMIN || vol.left > MIX_VOLMAX ||
+	    vol.right < MIX_VOLMIN || vol.right > MIX_VOLMAX) {
+		errno = ERANGE;
+		return (-1);
+	}
+	v = MIX_VOLDENORM(vol.left) | MIX_VOLDENORM(vol.right) << 8;
+	if (ioctl(m->fd, MIXER_WRITE(m->dev->devno), &v) < 0)
+		return (-1);
+	if (_compat_readvol(m, m->dev) < 0)
+		return (-1);
+
+	return (0);
+}
+__sym_compat(mixer_set_vol, freebsd17_mixer_set_vol, FBSD_1.7);
+
+int
+freebsd17_mixer_set_mute(mixer17_t *m, int opt)
+{
+	switch (opt) {
+	case MIX_MUTE:
+		m->mutemask |= (1 << m->dev->devno);
+		break;
+	case MIX_UNMUTE:
+		m->mutemask &= ~(1 << m->dev->devno);
+		break;
+	case MIX_TOGGLEMUTE:
+		m->mutemask ^= (1 << m->dev->devno);
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	if (ioctl(m->fd, SOUND_MIXER_WRITE_MUTE, &m->mutemask) < 0)
+		return (-1);
+	if (ioctl(m->fd, SOUND_MIXER_READ_MUTE, &m->mutemask) < 0)
+		return (-1);
+
+	return (0);
+}
+__sym_compat(mixer_set_mute, freebsd17_mixer_set_mute, FBSD_1.7);
+
+int
+freebsd17_mixer_mod_recsrc(mixer17_t *m, int opt)
+{
+	if (!m->recmask || !MIX_ISREC(m, m->dev->devno)) {
+		errno = ENODEV;
+		return (-1);
+	}
+	switch (opt) {
+	case MIX_ADDRECSRC:
+		m->recsrc |= (1 << m->dev->devno);
+		break;
+	case MIX_REMOVERECSRC:
+		m->recsrc &= ~(1 << m->dev->devno);
+		break;
+	case MIX_SETRECSRC:
+		m->recsrc = (1 << m->dev->devno);
+		break;
+	case MIX_TOGGLERECSRC:
+		m->recsrc ^= (1 << m->dev->devno);
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	if (ioctl(m->fd, SOUND_MIXER_WRITE_RECSRC, &m->recsrc) < 0)
+		return (-1);
+	if (ioctl(m->fd, SOUND_MIXER_READ_RECSRC, &m->recsrc) < 0)
+		return (-1);
+
+	return (0);
+}
+__sym_compat(mixer_mod_recsrc, freebsd17_mixer_mod_recsrc, FBSD_1.7);
@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Groups of mixers.
+ *
+ * A group holds open handles to several units and runs the same operation on
+ * all of them at once, one thread per unit, so that the slow ioctls of one
+ * card do not hold back the others and all cards change together.
+ */
+
+#include <sys/types.h>
+#include <sys/soundcard.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mixer.h"
+#include "mixer_private.h"
+
+#define GROUP_MAXUNIT	256			/* last unit looked for */
+
+struct mix_groupjob {
+	struct mix_group *g;
+	int idx;				/* member index */
+	int error;				/* errno of the last run */
+	int started;				/* runs in `thr` */
+	pthread_t thr;
+};
+
+struct mix_group {
+	int n;					/* number of members */
+	struct mixer **m;			/* members, NULL if not open */
+	int *unit;				/* unit of each member */
+	int *error;				/* errno of each failed open */
+	struct mix_groupjob *jobs;		/* one per member */
+	int (*fn)(struct mixer *, int, void *);	/* operation being applied */
+	void *arg;
+};
+
+static int _group_units(int **);
+static void *_group_run(void *);
+
+/*
+ * Find the units that exist. Units are numbered in the order cards attach
+ * and keep their number until the card goes away, so there can be gaps;
+ * SNDCTL_MIXERINFO tells whether a unit exists without opening it.
+ */
+static int
+_group_units(int **unitsp)
+{
+	struct mixer *m;
+	oss_mixerinfo mi;
+	int *units, n, unit, found = 0;
+
+	if ((n = mixer_get_nmixers()) < 0)
+		return (-1);
+	if (n == 0) {
+		errno = ENODEV;
+		return (-1);
+	}
+	if ((m = mixer_open(NULL)) == NULL)
+		return (-1);
+	if ((units = calloc(n, sizeof(int))) == NULL) {
+		(void)mixer_close(m);
+		return (-1);
+	}
+	for (unit = 0; found < n && unit < GROUP_MAXUNIT; unit++) {
+		mi.dev = unit;
+		if (_mixer_fdioctl(m->fd, unit, SNDCTL_MIXERINFO, &mi) == 0)
+			units[found++] = unit;
+	}
+	(void)mixer_close(m);
+	*unitsp = units;
+
+	return (found);
+}
+
+static void *
+_group_run(void *arg)
+{
+	struct mix_groupjob *j = arg;
+	struct mix_group *g = j->g;
+
+	j->error = 0;
+	if (g->m[j->idx] == NULL)
+		j->error = g->error[j->idx];
+	else if (g->fn(g->m[j->idx], j->idx, g->arg) < 0)
+		j->error = errno != 0 ? errno : EIO;
+
+	return (NULL);
+}
+
+/*
+ * Open the `n` units in `units`, or every unit if `units` is NULL. A unit
+ * that cannot be opened stays in the group without a handle, and its error
+ * is kept for `mixer_group_get` and `mixer_group_apply`; the group only
+ * fails if none of the units can be opened.
+ */
+struct mix_group *
+mixer_group_open(const int *units, int n)
+{
+	struct mix_group *g;
+	int *all = NULL;
+	char buf[NAME_MAX];
+	int i, e, nopen = 0;
+
+	if (units == NULL) {
+		if ((n = _group_units(&all)) < 0)
+			return (NULL);
+		units = all;
+	}
+	if (n <= 0) {
+		e = all != NULL ? ENODEV : EINVAL;
+		free(all);
+		errno = e;
+		return (NULL);
+	}
+	if ((g = calloc(1, sizeof(struct mix_group))) == NULL) {
+		free(all);
+		return (NULL);
+	}
+	if ((g->m = calloc(n, sizeof(struct mixer *))) == NULL ||
+	    (g->unit = calloc(n, sizeof(int))) == NULL ||
+	    (g->error = calloc(n, sizeof(int))) == NULL ||
+	    (g->jobs = calloc(n, sizeof(struct mix_groupjob))) == NULL)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		(void)snprintf(buf, sizeof(buf), "/dev/mixer%d", units[i]);
+		if ((g->m[i] = mixer_open(buf)) != NULL)
+			nopen++;
+		else
+			g->error[i] = errno != 0 ? errno : EIO;
+		g->unit[i] = units[i];
+		g->jobs[i].g = g;
+		g->jobs[i].idx = i;
+		g->n++;
+	}
+	if (nopen == 0) {
+		errno = g->error[0];
+		goto fail;
+	}
+	free(all);
+
+	return (g);
+fail:
+	e = errno;
+	(void)mixer_group_close(g);
+	free(all);
+	errno = e;
+
+	return (NULL);
+}
+
+/*
+ * Return the number of mixers in the group.
+ */
+int
+mixer_group_count(struct mix_group *g)
+{
+	return (g->n);
+}
+
+/*
+ * Return the group's `i`th mixer. Members are in the order their units were
+ * given to `mixer_group_open`, or in unit order. Returns NULL with errno
+ * set to the error of the open if the unit could not be opened.
+ */
+struct mixer *
+mixer_group_get(struct mix_group *g, int i)
+{
+	if (i < 0 || i >= g->n) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if (g->m[i] == NULL)
+		errno = g->error[i];
+
+	return (g->m[i]);
+}
+
+/*
+ * Return the unit of the group's `i`th mixer, opened or not.
+ */
+int
+mixer_group_unit(struct mix_group *g, int i)
+{
+	if (i < 0 || i >= g->n) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (g->unit[i]);
+}
+
+/*
+ * Call `fn` on every member at the same time, each from its own thread, and
+ * wait for all of them. `fn` gets the mixer, its index in the group and
+ * `arg`, and returns -1 with errno set on failure. Members never share
+ * state, so `fn` only has to be thread-safe with regard to `arg`. Members
+ * that could not be opened are skipped and fail with the open's error.
+ *
+ * @param errs		if not NULL, receives the errno of each member, or 0
+ *			if it succeeded; has to hold `mixer_group_count`
+ *			entries.
+ *
+ * Returns 0 if `fn` succeeded on every member, or -1 with errno set to the
+ * first member's error otherwise.
+ */
+int
+mixer_group_apply(struct mix_group *g, int (*fn)(struct mixer *, int, void *),
+    void *arg, int *errs)
+{
+	struct mix_groupjob *j;
+	int i, e = 0;
+
+	if (fn == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	g->fn = fn;
+	g->arg = arg;
+	/*
+	 * The calling thread takes the first member. Members whose thread
+	 * cannot be created run here afterwards.
+	 */
+	for (i = 1; i < g->n; i++) {
+		j = &g->jobs[i];
+		j->started = pthread_create(&j->thr, NULL, _group_run,
+		    j) == 0;
+	}
+	(void)_group_run(&g->jobs[0]);
+	for (i = 1; i < g->n; i++) {
+		j = &g->jobs[i];
+		if (j->started)
+			(void)pthread_join(j->thr, NULL);
+		else
+			(void)_group_run(j);
+	}
+	for (i = 0; i < g->n; i++) {
+		if (errs != NULL)
+			errs[i] = g->jobs[i].error;
+		if (e == 0)
+			e = g->jobs[i].error;
+	}
+	if (e != 0) {
+		errno = e;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Close all members and free the group.
+ */
+int
+mixer_group_close(struct mix_group *g)
+{
+	int i, e = 0;
+
+	for (i = 0; i < g->n; i++) {
+		if (g->m[i] != NULL && mixer_close(g->m[i]) < 0 && e == 0)
+			e = errno;
+	}
+	free(g->jobs);
+	free(g->error);
+	free(g->unit);
+	free(g->m);
+	free(g);
+	if (e != 0) {
+		errno = e;
+		return (-1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,479 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Hotplug-aware set of mixers.
+ *
+ * The manager keeps a handle open for every attached unit and follows device
+ * events, so that only the unit an event is about is opened or closed; the
+ * handles of the other units, and whatever the caller built on them, stay as
+ * they are. When a unit goes away, its state is kept under the card's device
+ * node and name, and written back, or replaced by the preset the caller set
+ * for cards with that name, once the card attaches again. Identical cards
+ * have the same name, so the node tells them apart; a card that comes back
+ * under another node gets the state of a card with its name that is not
+ * attached.
+ *
+ * Events come from a pluggable source. The default one listens to devd(8)
+ * for mixer device nodes being created and destroyed.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mixer.h"
+
+#define _PATH_DEVDPIPE	"/var/run/devd.seqpacket.pipe"
+#define HP_MAXUNIT	256			/* last unit tried on start */
+
+struct mix_hpunit {
+	int unit;
+	struct mixer *m;
+	struct mix_hpcard *card;		/* card seen before, or NULL */
+	TAILQ_ENTRY(mix_hpunit) units;
+};
+
+/*
+ * A card the manager has seen go away, or a preset for all cards with a
+ * name, in which case `node` is empty.
+ */
+struct mix_hpcard {
+	char name[sizeof(((oss_card_info *)0)->longname)];
+	char node[sizeof(((oss_mixerinfo *)0)->devnode)];
+	struct mix_preset *state;		/* state when last detached */
+	struct mix_preset *preset;		/* caller's preset, or NULL */
+	int attached;				/* a unit has claimed it */
+	TAILQ_ENTRY(mix_hpcard) cards;
+};
+
+struct mix_hotplug {
+	struct mix_hpsource src;		/* event source */
+	void (*cb)(struct mixer *, int, void *); /* attach/detach callback */
+	void *cbarg;
+	struct mix_preset *preset;		/* preset for any card */
+	TAILQ_HEAD(, mix_hpunit) units;		/* open units */
+	TAILQ_HEAD(, mix_hpcard) cards;		/* known cards */
+};
+
+static int _hp_devd_getfd(void *);
+static int _hp_devd_next(void *, struct mix_hpevent *);
+static void _hp_devd_close(void *);
+static int _hp_devd_open(struct mix_hpsource *);
+static const char *_hp_node(struct mixer *);
+static struct mix_hpcard *_hp_card(struct mix_hotplug *, const char *,
+    const char *, int);
+static struct mix_hpcard *_hp_claim(struct mix_hotplug *, struct mixer *);
+static int _hp_attach(struct mix_hotplug *, int, int);
+static void _hp_detach(struct mix_hotplug *, struct mix_hpunit *);
+
+static int
+_hp_devd_getfd(void *arg)
+{
+	return (*(int *)arg);
+}
+
+/*
+ * Turn devd(8) notifications such as
+ * "!system=DEVFS subsystem=CDEV type=CREATE cdev=mixer1" into events.
+ * Everything else devd reports is skipped.
+ */
+static int
+_hp_devd_next(void *arg, struct mix_hpevent *ev)
+{
+	char buf[1024], *p, *tok, *val, *endp;
+	const char *sys, *subsys, *type, *cdev;
+	ssize_t n;
+	long unit;
+
+	for (;;) {
+		if ((n = recv(*(int *)arg, buf, sizeof(buf) - 1,
+		    MSG_DONTWAIT)) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return (0);
+			return (-1);
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return (-1);
+		}
+		buf[n] = '\0';
+		if (*buf != '!')
+			continue;
+		sys = subsys = type = cdev = "";
+		p = buf + 1;
+		while ((tok = strsep(&p, " \n")) != NULL) {
+			if ((val = strchr(tok, '=')) == NULL)
+				continue;
+			*val++ = '\0';
+			if (!strcmp(tok, "system"))
+				sys = val;
+			else if (!strcmp(tok, "subsystem"))
+				subsys = val;
+			else if (!strcmp(tok, "type"))
+				type = val;
+			else if (!strcmp(tok, "cdev"))
+				cdev = val;
+		}
+		if (strcmp(sys, "DEVFS") || strcmp(subsys, "CDEV") ||
+		    strncmp(cdev, "mixer", 5))
+			continue;
+		unit = strtol(cdev + 5, &endp, 10);
+		if (cdev[5] == '\0' || *endp != '\0' || unit < 0 ||
+		    unit > INT_MAX)
+			continue;
+		if (!strcmp(type, "CREATE"))
+			ev->type = MIX_HP_ATTACH;
+		else if (!strcmp(type, "DESTROY"))
+			ev->type = MIX_HP_DETACH;
+		else
+			continue;
+		ev->unit = unit;
+
+		return (1);
+	}
+}
+
+static void
+_hp_devd_close(void *arg)
+{
+	(void)close(*(int *)arg);
+	free(arg);
+}
+
+static int
+_hp_devd_open(struct mix_hpsource *src)
+{
+	struct sockaddr_un sun;
+	int *fd;
+
+	if ((fd = malloc(sizeof(int))) == NULL)
+		return (-1);
+	if ((*fd = socket(PF_LOCAL, SOCK_SEQPACKET, 0)) < 0) {
+		free(fd);
+		return (-1);
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	(void)strlcpy(sun.sun_path, _PATH_DEVDPIPE, sizeof(sun.sun_path));
+	if (connect(*fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		_hp_devd_close(fd);
+		return (-1);
+	}
+	src->getfd = _hp_devd_getfd;
+	src->next = _hp_devd_next;
+	src->close = _hp_devd_close;
+	src->arg = fd;
+
+	return (0);
+}
+
+/*
+ * Return the device node of a mixer, which no other attached card has.
+ */
+static const char *
+_hp_node(struct mixer *m)
+{
+	return (*m->mi.devnode != '\0' ? m->mi.devnode : m->name);
+}
+
+/*
+ * Look up a card by name and node, adding it if `create` is set. An empty
+ * `node` looks up the preset for the name.
+ */
+static struct mix_hpcard *
+_hp_card(struct mix_hotplug *h, const char *name, const char *node,
+    int create)
+{
+	struct mix_hpcard *c;
+
+	TAILQ_FOREACH(c, &h->cards, cards) {
+		if (!strcmp(c->name, name) && !strcmp(c->node, node))
+			return (c);
+	}
+	if (!create || (c = calloc(1, sizeof(struct mix_hpcard))) == NULL)
+		return (NULL);
+	(void)strlcpy(c->name, name, sizeof(c->name));
+	(void)strlcpy(c->node, node, sizeof(c->node));
+	TAILQ_INSERT_TAIL(&h->cards, c, cards);
+
+	return (c);
+}
+
+/*
+ * Find the card that has attached as `m`: the one last seen under the same
+ * node, or else one with the same name that is not attached, which then
+ * moves to the new node.
+ */
+static struct mix_hpcard *
+_hp_claim(struct mix_hotplug *h, struct mixer *m)
+{
+	struct mix_hpcard *c;
+	const char *node = _hp_node(m);
+
+	if ((c = _hp_card(h, m->ci.longname, node, 0)) == NULL ||
+	    c->attached) {
+		TAILQ_FOREACH(c, &h->cards, cards) {
+			if (*c->node != '\0' && !c->attached &&
+			    !strcmp(c->name, m->ci.longname))
+				break;
+		}
+		if (c == NULL)
+			return (NULL);
+		(void)strlcpy(c->node, node, sizeof(c->node));
+	}
+	c->attached = 1;
+
+	return (c);
+}
+
+/*
+ * Open `unit`. A card that has been seen before gets its preset, or else its
+ * last state, written back; other cards get the preset for any card, if
+ * there is one, unless they were there from the start.
+ */
+static int
+_hp_attach(struct mix_hotplug *h, int unit, int initial)
+{
+	struct mix_hpunit *u;
+	struct mix_hpcard *c;
+	struct mix_preset *p = NULL;
+	char buf[NAME_MAX];
+
+	(void)snprintf(buf, sizeof(buf), "/dev/mixer%d", unit);
+	if ((u = calloc(1, sizeof(struct mix_hpunit))) == NULL)
+		return (-1);
+	if ((u->m = mixer_open(buf)) == NULL) {
+		free(u);
+		return (-1);
+	}
+	u->unit = unit;
+	TAILQ_INSERT_TAIL(&h->units, u, units);
+	if (!initial) {
+		u->card = _hp_claim(h, u->m);
+		if ((c = _hp_card(h, u->m->ci.longname, "", 0)) != NULL)
+			p = c->preset;
+		if (p == NULL && u->card != NULL)
+			p = u->card->state;
+		if (p == NULL)
+			p = h->preset;
+		/* Best effort; the card may lack some devices. */
+		if (p != NULL)
+			(void)mixer_preset_apply(u->m, p);
+	}
+	if (h->cb != NULL)
+		h->cb(u->m, MIX_HP_ATTACH, h->cbarg);
+
+	return (0);
+}
+
+/*
+ * Close a unit and remember its state under the card's node and name.
+ */
+static void
+_hp_detach(struct mix_hotplug *h, struct mix_hpunit *u)
+{
+	struct mix_hpcard *c;
+	struct mix_preset *p;
+
+	if (h->cb != NULL)
+		h->cb(u->m, MIX_HP_DETACH, h->cbarg);
+	/* The device is gone, so this is the last state the handle saw. */
+	if ((c = u->card) == NULL)
+		c = _hp_card(h, u->m->ci.longname, _hp_node(u->m), 1);
+	if (c != NULL) {
+		c->attached = 0;
+		if ((p = mixer_preset_capture(u->m)) != NULL) {
+			mixer_preset_free(c->state);
+			c->state = p;
+		}
+	}
+	TAILQ_REMOVE(&h->units, u, units);
+	(void)mixer_close(u->m);
+	free(u);
+}
+
+/*
+ * Create a manager and open every unit that is attached already.
+ *
+ * @param src		event source, copied; NULL for devd(8).
+ * @param cb		if not NULL, called with MIX_HP_ATTACH after a unit
+ *			has been opened, including the ones opened here, and
+ *			with MIX_HP_DETACH before it is closed.
+ */
+struct mix_hotplug *
+mixer_hotplug_new(const struct mix_hpsource *src,
+    void (*cb)(struct mixer *, int, void *), void *cbarg)
+{
+	struct mix_hotplug *h;
+	int n, unit, found = 0;
+
+	if (src != NULL && (src->getfd == NULL || src->next == NULL)) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((h = calloc(1, sizeof(struct mix_hotplug))) == NULL)
+		return (NULL);
+	TAILQ_INIT(&h->units);
+	TAILQ_INIT(&h->cards);
+	h->cb = cb;
+	h->cbarg = cbarg;
+	if (src != NULL)
+		h->src = *src;
+	else if (_hp_devd_open(&h->src) < 0) {
+		free(h);
+		return (NULL);
+	}
+	/* Units have gaps once cards have come and gone. */
+	if ((n = mixer_get_nmixers()) < 0)
+		n = 0;
+	for (unit = 0; found < n && unit < HP_MAXUNIT; unit++) {
+		if (_hp_attach(h, unit, 1) == 0)
+			found++;
+	}
+
+	return (h);
+}
+
+/*
+ * Return the descriptor to poll(2) for events; call
+ * `mixer_hotplug_dispatch` when it is readable.
+ */
+int
+mixer_hotplug_getfd(struct mix_hotplug *h)
+{
+	return (h->src.getfd(h->src.arg));
+}
+
+/*
+ * Handle all pending events. Returns the number of units opened or closed,
+ * or -1 if the event source failed.
+ */
+int
+mixer_hotplug_dispatch(struct mix_hotplug *h)
+{
+	struct mix_hpevent ev;
+	struct mix_hpunit *u;
+	int rc, n = 0;
+
+	while ((rc = h->src.next(h->src.arg, &ev)) > 0) {
+		TAILQ_FOREACH(u, &h->units, units) {
+			if (u->unit == ev.unit)
+				break;
+		}
+		switch (ev.type) {
+		case MIX_HP_ATTACH:
+			/* A detach we did not hear about. */
+			if (u != NULL) {
+				_hp_detach(h, u);
+				n++;
+			}
+			if (_hp_attach(h, ev.unit, 0) == 0)
+				n++;
+			break;
+		case MIX_HP_DETACH:
+			if (u != NULL) {
+				_hp_detach(h, u);
+				n++;
+			}
+			break;
+		}
+	}
+	if (rc < 0)
+		return (-1);
+
+	return (n);
+}
+
+/*
+ * Return the handle of `unit`, or NULL if it is not attached. The handle
+ * stays valid until the unit is detached.
+ */
+struct mixer *
+mixer_hotplug_get(struct mix_hotplug *h, int unit)
+{
+	struct mix_hpunit *u;
+
+	TAILQ_FOREACH(u, &h->units, units) {
+		if (u->unit == unit)
+			return (u->m);
+	}
+	errno = ENODEV;
+
+	return (NULL);
+}
+
+/*
+ * Apply `p` to cards named `card` whenever one attaches, instead of the
+ * state the card had when it went away; a NULL `card` applies `p` to cards
+ * without a preset or a known state. A NULL `p` removes the preset. The
+ * preset is not copied and has to outlive the manager, or be removed first.
+ */
+int
+mixer_hotplug_set_preset(struct mix_hotplug *h, const char *card,
+    struct mix_preset *p)
+{
+	struct mix_hpcard *c;
+
+	if (card == NULL) {
+		h->preset = p;
+		return (0);
+	}
+	if ((c = _hp_card(h, card, "", 1)) == NULL)
+		return (-1);
+	c->preset = p;
+
+	return (0);
+}
+
+/*
+ * Close all units and the event source, and free the manager.
+ */
+void
+mixer_hotplug_free(struct mix_hotplug *h)
+{
+	struct mix_hpunit *u;
+	struct mix_hpcard *c;
+
+	while ((u = TAILQ_FIRST(&h->units)) != NULL) {
+		TAILQ_REMOVE(&h->units, u, units);
+		(void)mixer_close(u->m);
+		free(u);
+	}
+	while ((c = TAILQ_FIRST(&h->cards)) != NULL) {
+		TAILQ_REMOVE(&h->cards, c, cards);
+		mixer_preset_free(c->state);
+		free(c);
+	}
+	if (h->src.close != NULL)
+		h->src.close(h->src.arg);
+	free(h);
+}
@@ -0,0 +1,490 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Peak, RMS and clip metering of PCM streams.
+ *
+ * Samples are accumulated per channel and a result is published every
+ * `interval` milliseconds worth of frames. The kernels work on a flat run of
+ * samples with a fixed number of lanes, a multiple of the channel count, so
+ * that the inner loop has no dependency between lanes and the compiler can
+ * vectorize it; lanes are folded into channels once per call.
+ */
+
+#include <sys/types.h>
+#include <sys/endian.h>
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mixer.h"
+#include "mixer_private.h"
+
+#define METER_LANES	16
+
+struct mix_meter {
+	int fd;					/* dsp descriptor, or -1 */
+	int fmt;				/* AFMT_S16_NE, ... */
+	int nchan;				/* channels */
+	int bps;				/* bytes per sample */
+	int lanes;				/* kernel lanes */
+	int decim;				/* decimation factor */
+	int skip;				/* frames to skip */
+	size_t period;				/* frames per result */
+	size_t nframes;				/* frames seen in this period */
+	size_t nsamp;				/* frames analyzed */
+	float peak[MIX_METER_MAXCHAN];
+	double sum[MIX_METER_MAXCHAN];		/* sum of squares */
+	unsigned int clips[MIX_METER_MAXCHAN];
+	/* Published results, read with `seq` as a sequence lock. */
+	atomic_uint seq;
+	struct mix_level pub[MIX_METER_MAXCHAN];
+	void *buf;				/* read buffer for the dsp */
+	size_t bufsz;
+	size_t carry;				/* partial frame read last */
+};
+
+static int _meter_bps(int);
+static int32_t _meter_s24(const uint8_t *);
+static float _meter_load(int, const uint8_t *, int *);
+static void _meter_fold(struct mix_meter *, const float *, const float *,
+    const unsigned int *);
+static void _meter_publish(struct mix_meter *);
+static void _meter_run(struct mix_meter *, const uint8_t *, size_t);
+static void _meter_decim(struct mix_meter *, const uint8_t *, size_t);
+
+/*
+ * Bytes per sample of the supported formats, 0 for the others.
+ */
+static int
+_meter_bps(int fmt)
+{
+	switch (fmt) {
+	case AFMT_S16_NE:
+		return (2);
+	case AFMT_S24_NE:
+		return (3);
+	case AFMT_S32_NE:
+		return (4);
+	default:
+		return (0);
+	}
+}
+
+static inline int32_t
+_meter_s24(const uint8_t *p)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+	return ((int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 24) >> 8);
+#else
+	return ((int32_t)((uint32_t)p[2] << 8 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[0] << 24) >> 8);
+#endif
+}
+
+/*
+ * Load a single sample, scaled to [0, 1], and tell whether it is at full
+ * scale. The kernels below do the same for a run of samples.
+ */
+static inline float
+_meter_load(int bps, const uint8_t *p, int *clip)
+{
+	int32_t x;
+
+	switch (bps) {
+	case 2:
+		x = *(const int16_t *)p;
+		*clip = x == INT16_MAX || x == INT16_MIN;
+		return (fabsf(x / 32768.0f));
+	case 3:
+		x = _meter_s24(p);
+		*clip = x == 8388607 || x == -8388608;
+		return (fabsf(x / 8388608.0f));
+	default:
+		x = *(const int32_t *)p;
+		*clip = x == INT32_MAX || x == INT32_MIN;
+		return (fabsf(x / 2147483648.0f));
+	}
+}
+
+/*
+ * One kernel per format. `n` is a multiple of `lanes`; lane `j` always sees
+ * the same channel because `lanes` is a multiple of the channel count.
+ * Clipping is judged on the integer sample, like `_meter_load` does, since
+ * the scaled float can round up to full scale.
+ */
+#define METER_KERNEL(name, type, load, scale, min, max)			\
+static void								\
+name(const uint8_t *buf, size_t n, int lanes, float *peak, float *sum,	\
+    unsigned int *clips)						\
+{									\
+	const type *s = (const type *)buf;				\
+	int32_t x;							\
+	float v;							\
+	size_t i;							\
+	int j;								\
+									\
+	for (i = 0; i < n; i += lanes) {				\
+		for (j = 0; j < lanes; j++) {				\
+			x = load;					\
+			v = fabsf((float)x * (scale));			\
+			peak[j] = v > peak[j] ? v : peak[j];		\
+			sum[j] += v * v;				\
+			clips[j] += x == (min) || x == (max);		\
+		}							\
+	}								\
+}
+
+METER_KERNEL(_meter_k16, int16_t, s[i + j], 1.0f / 32768.0f, INT16_MIN,
+    INT16_MAX)
+METER_KERNEL(_meter_k24, uint8_t, _meter_s24(&s[(i + j) * 3]),
+    1.0f / 8388608.0f, -8388608, 8388607)
+METER_KERNEL(_meter_k32, int32_t, s[i + j], 1.0f / 2147483648.0f, INT32_MIN,
+    INT32_MAX)
+
+static void
+_meter_fold(struct mix_meter *mm, const float *peak, const float *sum,
+    const unsigned int *clips)
+{
+	int c, j;
+
+	for (j = 0; j < mm->lanes; j++) {
+		c = j % mm->nchan;
+		if (peak[j] > mm->peak[c])
+			mm->peak[c] = peak[j];
+		mm->sum[c] += sum[j];
+		mm->clips[c] += clips[j];
+	}
+}
+
+/*
+ * Analyze `n` whole frames, none of which crosses a period boundary.
+ */
+static void
+_meter_run(struct mix_meter *mm, const uint8_t *buf, size_t n)
+{
+	float peak[METER_LANES], sum[METER_LANES], v;
+	unsigned int clips[METER_LANES];
+	size_t nsamp, body;
+	int c, clip;
+
+	if (mm->decim > 1) {
+		_meter_decim(mm, buf, n);
+		return;
+	}
+	nsamp = n * mm->nchan;
+	body = nsamp - nsamp % mm->lanes;
+	memset(peak, 0, sizeof(peak));
+	memset(sum, 0, sizeof(sum));
+	memset(clips, 0, sizeof(clips));
+	switch (mm->bps) {
+	case 2:
+		_meter_k16(buf, body, mm->lanes, peak, sum, clips);
+		break;
+	case 3:
+		_meter_k24(buf, body, mm->lanes, peak, sum, clips);
+		break;
+	case 4:
+		_meter_k32(buf, body, mm->lanes, peak, sum, clips);
+		break;
+	}
+	_meter_fold(mm, peak, sum, clips);
+	mm->nsamp += body / mm->nchan;
+
+	/* The tail is less than `lanes` samples, but still whole frames. */
+	buf += body * mm->bps;
+	for (; body < nsamp; body++, buf += mm->bps) {
+		c = body % mm->nchan;
+		v = _meter_load(mm->bps, buf, &clip);
+		if (v > mm->peak[c])
+			mm->peak[c] = v;
+		mm->sum[c] += v * v;
+		mm->clips[c] += clip;
+		if (c == mm->nchan - 1)
+			mm->nsamp++;
+	}
+}
+
+/*
+ * Same as `_meter_run`, looking only at every `decim`-th frame.
+ */
+static void
+_meter_decim(struct mix_meter *mm, const uint8_t *buf, size_t n)
+{
+	const uint8_t *p;
+	size_t f, fsz;
+	float v;
+	int c, clip;
+
+	fsz = (size_t)mm->nchan * mm->bps;
+	for (f = mm->skip; f < n; f += mm->decim) {
+		p = buf + f * fsz;
+		for (c = 0; c < mm->nchan; c++, p += mm->bps) {
+			v = _meter_load(mm->bps, p, &clip);
+			if (v > mm->peak[c])
+				mm->peak[c] = v;
+			mm->sum[c] += v * v;
+			mm->clips[c] += clip;
+		}
+		mm->nsamp++;
+	}
+	mm->skip = f - n;
+}
+
+/*
+ * Make the current period's results visible to `mixer_meter_get` and start
+ * a new period.
+ */
+static void
+_meter_publish(struct mix_meter *mm)
+{
+	unsigned int seq;
+	int c;
+
+	seq = atomic_load_explicit(&mm->seq, memory_order_relaxed);
+	atomic_store_explicit(&mm->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (c = 0; c < mm->nchan; c++) {
+		mm->pub[c].peak = mm->peak[c];
+		mm->pub[c].rms = mm->nsamp > 0 ?
+		    sqrtf(mm->sum[c] / mm->nsamp) : 0.0f;
+		mm->pub[c].clips = mm->clips[c];
+	}
+	atomic_store_explicit(&mm->seq, seq + 2, memory_order_release);
+
+	memset(mm->peak, 0, sizeof(mm->peak));
+	memset(mm->sum, 0, sizeof(mm->sum));
+	memset(mm->clips, 0, sizeof(mm->clips));
+	mm->nsamp = 0;
+	mm->nframes = 0;
+}
+
+/*
+ * Create a meter for caller-supplied buffers.
+ *
+ * @param fmt		AFMT_S16_NE, AFMT_S24_NE or AFMT_S32_NE.
+ * @param nchan		number of interleaved channels, at most
+ *			MIX_METER_MAXCHAN.
+ * @param rate		sample rate in Hz.
+ * @param interval	milliseconds of audio per published result.
+ * @param decim		analyze only every `decim`-th frame; 1 for all.
+ */
+struct mix_meter *
+mixer_meter_new(int fmt, int nchan, int rate, int interval, int decim)
+{
+	struct mix_meter *mm;
+	int bps;
+
+	if ((bps = _meter_bps(fmt)) == 0 || nchan < 1 ||
+	    nchan > MIX_METER_MAXCHAN || rate < 1 || interval < 1 ||
+	    decim < 1) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((mm = calloc(1, sizeof(struct mix_meter))) == NULL)
+		return (NULL);
+	mm->fd = -1;
+	mm->fmt = fmt;
+	mm->nchan = nchan;
+	mm->bps = bps;
+	mm->lanes = METER_LANES - METER_LANES % nchan;
+	mm->decim = decim;
+	mm->period = (size_t)rate * interval / 1000;
+	if (mm->period == 0)
+		mm->period = 1;
+	atomic_init(&mm->seq, 0);
+
+	return (mm);
+}
+
+/*
+ * Create a meter that reads from a dsp device.
+ *
+ * @param name		path to the dsp device (e.g /dev/dsp0), NULL for
+ *			/dev/dsp.
+ *
+ * The rest of the arguments are the same as in `mixer_meter_new`; the
+ * device has to accept the format, channel count and rate as given.
+ */
+struct mix_meter *
+mixer_meter_open(const char *name, int fmt, int nchan, int rate, int interval,
+    int decim)
+{
+	struct mix_meter *mm;
+	int v;
+
+	if ((mm = mixer_meter_new(fmt, nchan, rate, interval, decim)) == NULL)
+		return (NULL);
+	if ((mm->fd = open(name != NULL ? name : "/dev/dsp", O_RDONLY)) < 0)
+		goto fail;
+	v = fmt;
+	if (_mixer_fdioctl(mm->fd, -1, SNDCTL_DSP_SETFMT, &v) < 0)
+		goto fail;
+	if (v != fmt)
+		goto inval;
+	v = nchan;
+	if (_mixer_fdioctl(mm->fd, -1, SNDCTL_DSP_CHANNELS, &v) < 0)
+		goto fail;
+	if (v != nchan)
+		goto inval;
+	v = rate;
+	if (_mixer_fdioctl(mm->fd, -1, SNDCTL_DSP_SPEED, &v) < 0)
+		goto fail;
+	if (v != rate)
+		goto inval;
+	mm->bufsz = mm->period * nchan * mm->bps;
+	if ((mm->buf = malloc(mm->bufsz)) == NULL)
+		goto fail;
+
+	return (mm);
+inval:
+	errno = EINVAL;
+fail:
+	v = errno;
+	(void)mixer_meter_close(mm);
+	errno = v;
+
+	return (NULL);
+}
+
+/*
+ * Feed `len` bytes of interleaved samples to the meter. Trailing bytes that
+ * do not make a whole frame are ignored.
+ *
+ * Returns the number of results published, which is 0 if the period has
+ * not been completed yet.
+ */
+int
+mixer_meter_feed(struct mix_meter *mm, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t fsz, n, left;
+	int npub = 0;
+
+	fsz = (size_t)mm->nchan * mm->bps;
+	for (n = len / fsz; n > 0; n -= left) {
+		left = mm->period - mm->nframes;
+		if (left > n)
+			left = n;
+		_meter_run(mm, p, left);
+		p += left * fsz;
+		if ((mm->nframes += left) == mm->period) {
+			_meter_publish(mm);
+			npub++;
+		}
+	}
+
+	return (npub);
+}
+
+/*
+ * Read up to one period from the dsp device and feed it to the meter. A
+ * partial frame at the end of the read is kept at the start of the buffer
+ * and completed by the next read.
+ */
+int
+mixer_meter_read(struct mix_meter *mm)
+{
+	uint8_t *p = mm->buf;
+	size_t fsz, len, rest;
+	ssize_t n;
+	int npub;
+
+	if (mm->fd < 0) {
+		errno = EBADF;
+		return (-1);
+	}
+	if ((n = read(mm->fd, p + mm->carry, mm->bufsz - mm->carry)) < 0)
+		return (-1);
+	fsz = (size_t)mm->nchan * mm->bps;
+	len = mm->carry + n;
+	rest = len % fsz;
+	npub = mixer_meter_feed(mm, p, len - rest);
+	memmove(p, p + len - rest, rest);
+	mm->carry = rest;
+
+	return (npub);
+}
+
+/*
+ * Copy the last published results of up to `n` channels into `lv`. This
+ * can be called from any thread, concurrently with the one feeding the
+ * meter.
+ *
+ * Returns the number of channels copied, 0 if nothing has been published
+ * yet, or -1 if `n` is negative.
+ */
+int
+mixer_meter_get(struct mix_meter *mm, struct mix_level *lv, int n)
+{
+	unsigned int seq;
+
+	if (n < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (n > mm->nchan)
+		n = mm->nchan;
+	do {
+		while ((seq = atomic_load_explicit(&mm->seq,
+		    memory_order_acquire)) & 1)
+			;
+		if (seq == 0)
+			return (0);
+		memcpy(lv, mm->pub, n * sizeof(struct mix_level));
+		atomic_thread_fence(memory_order_acquire);
+	} while (atomic_load_explicit(&mm->seq, memory_order_relaxed) != seq);
+
+	return (n);
+}
+
+/*
+ * Descriptor of the dsp device, for use with poll(2), or -1.
+ */
+int
+mixer_meter_getfd(struct mix_meter *mm)
+{
+	return (mm->fd);
+}
+
+int
+mixer_meter_close(struct mix_meter *mm)
+{
+	int r = 0;
+
+	if (mm->fd >= 0)
+		r = close(mm->fd);
+	free(mm->buf);
+	free(mm);
+
+	return (r);
+}
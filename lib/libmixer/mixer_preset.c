@@ -0,0 +1,238 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Mixer presets.
+ *
+ * A preset is compiled once into per-device target values and masks, so
+ * applying it costs no parsing or lookups. Applying only writes what differs
+ * from the state cached in the mixer handle, and orders the writes so that
+ * level changes are not heard as pops: devices that end up muted are muted
+ * first, volumes going down are written before volumes going up, and devices
+ * that end up unmuted are unmuted last.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mixer.h"
+
+struct mix_preset {
+	int volmask;				/* devices with a volume */
+	int mutedevs;				/* devices with a mute state */
+	int mutemask;				/* which of them are muted */
+	int srcdevs;				/* devices with a source state */
+	int recsrc;				/* which of them are sources */
+	mix_volume_t vol[SOUND_MIXER_NRDEVICES];
+};
+
+static const char *_preset_devnames[SOUND_MIXER_NRDEVICES] =
+    SOUND_DEVICE_NAMES;
+
+static int _preset_devno(const char *);
+
+static int
+_preset_devno(const char *name)
+{
+	int i;
+
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++) {
+		if (!strcmp(_preset_devnames[i], name))
+			return (i);
+	}
+
+	return (-1);
+}
+
+/*
+ * Compile `n` device states into a preset. Later entries for the same
+ * device override the fields they set. Volumes are rounded to the whole
+ * percentages the driver stores.
+ */
+struct mix_preset *
+mixer_preset_compile(const struct mix_preset_ent *ent, int n)
+{
+	struct mix_preset *p;
+	const struct mix_preset_ent *e;
+	int all = MIX_PRESET_VOL | MIX_PRESET_MUTE | MIX_PRESET_RECSRC;
+	int bit, devno, i;
+
+	if (ent == NULL || n < 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((p = calloc(1, sizeof(struct mix_preset))) == NULL)
+		return (NULL);
+	for (i = 0; i < n; i++) {
+		e = &ent[i];
+		if (e->dev == NULL || (devno = _preset_devno(e->dev)) < 0 ||
+		    e->flags == 0 || (e->flags & ~all)) {
+			errno = EINVAL;
+			goto fail;
+		}
+		bit = 1 << devno;
+		if (e->flags & MIX_PRESET_VOL) {
+			if (e->vol.left < MIX_VOLMIN ||
+			    e->vol.left > MIX_VOLMAX ||
+			    e->vol.right < MIX_VOLMIN ||
+			    e->vol.right > MIX_VOLMAX) {
+				errno = ERANGE;
+				goto fail;
+			}
+			p->volmask |= bit;
+			p->vol[devno].left =
+			    MIX_VOLNORM(MIX_VOLDENORM(e->vol.left));
+			p->vol[devno].right =
+			    MIX_VOLNORM(MIX_VOLDENORM(e->vol.right));
+		}
+		if (e->flags & MIX_PRESET_MUTE) {
+			p->mutedevs |= bit;
+			if (e->mute)
+				p->mutemask |= bit;
+			else
+				p->mutemask &= ~bit;
+		}
+		if (e->flags & MIX_PRESET_RECSRC) {
+			p->srcdevs |= bit;
+			if (e->recsrc)
+				p->recsrc |= bit;
+			else
+				p->recsrc &= ~bit;
+		}
+	}
+
+	return (p);
+fail:
+	free(p);
+
+	return (NULL);
+}
+
+/*
+ * Make a preset out of the state cached in `m`: the volume and mute of every
+ * device, and the recording sources.
+ */
+struct mix_preset *
+mixer_preset_capture(struct mixer *m)
+{
+	struct mix_preset *p;
+	struct mix_dev *dp;
+
+	if ((p = calloc(1, sizeof(struct mix_preset))) == NULL)
+		return (NULL);
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		p->volmask |= 1 << dp->devno;
+		p->vol[dp->devno] = dp->vol;
+	}
+	p->mutedevs = m->devmask;
+	p->mutemask = m->mutemask & m->devmask;
+	p->srcdevs = m->recmask;
+	p->recsrc = m->recsrc & m->recmask;
+
+	return (p);
+}
+
+/*
+ * Bring `m` to the state in `p`. The difference is taken against the state
+ * cached in `m`, so callers that share the mixer with other programs should
+ * call `mixer_refresh` first. Fails with ENODEV, without writing anything,
+ * if the preset refers to devices or recording sources `m` does not have.
+ *
+ * Returns the number of writes issued, or -1 if any of them failed. A failed
+ * write does not stop the ones after it.
+ */
+int
+mixer_preset_apply(struct mixer *m, const struct mix_preset *p)
+{
+	struct mix_dev *dp, *sel;
+	const mix_volume_t *v;
+	int mute, src, l, r, up, pass, n = 0, e = 0;
+
+	if (((p->volmask | p->mutedevs) & ~m->devmask) ||
+	    (p->srcdevs & ~m->recmask)) {
+		errno = ENODEV;
+		return (-1);
+	}
+	mute = (m->mutemask & ~p->mutedevs) | p->mutemask;
+	src = (m->recsrc & ~p->srcdevs) | p->recsrc;
+
+	if (mute & ~m->mutemask) {
+		n++;
+		if (mixer_set_mutemask(m, m->mutemask | mute,
+		    MIX_SETMUTE) < 0 && e == 0)
+			e = errno;
+	}
+	if (src != m->recsrc) {
+		n++;
+		if (mixer_set_recsrcmask(m, src, MIX_SETRECSRC) < 0 && e == 0)
+			e = errno;
+	}
+	sel = m->dev;
+	for (pass = 0; pass < 2; pass++) {
+		TAILQ_FOREACH(dp, &m->devs, devs) {
+			if (!MIX_ISSET(dp->devno, p->volmask))
+				continue;
+			v = &p->vol[dp->devno];
+			l = MIX_VOLDENORM(v->left);
+			r = MIX_VOLDENORM(v->right);
+			if (l == MIX_VOLDENORM(dp->vol.left) &&
+			    r == MIX_VOLDENORM(dp->vol.right))
+				continue;
+			/* Lower in the first pass, raise in the second. */
+			up = l > MIX_VOLDENORM(dp->vol.left) ||
+			    r > MIX_VOLDENORM(dp->vol.right);
+			if (up != pass)
+				continue;
+			m->dev = dp;
+			n++;
+			if (mixer_set_vol(m, *v) < 0 && e == 0)
+				e = errno;
+		}
+	}
+	m->dev = sel;
+	if (mute != m->mutemask) {
+		n++;
+		if (mixer_set_mutemask(m, mute, MIX_SETMUTE) < 0 && e == 0)
+			e = errno;
+	}
+	if (e != 0) {
+		errno = e;
+		return (-1);
+	}
+
+	return (n);
+}
+
+/*
+ * Free a preset.
+ */
+void
+mixer_preset_free(struct mix_preset *p)
+{
+	free(p);
+}
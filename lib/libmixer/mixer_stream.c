@@ -0,0 +1,192 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Volume and mute of a single stream.
+ *
+ * With the patched sound(4), a dsp descriptor takes the mixer requests for
+ * its own channel: SOUND_MIXER_PCM for playback, SOUND_MIXER_RECLEV for
+ * recording, and SOUND_MIXER_MUTE. Going through the descriptor instead of
+ * the card's mixer lets every stream be adjusted on its own, without
+ * touching the state other programs share.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "mixer.h"
+#include "mixer_private.h"
+
+struct mix_stream {
+	int fd;					/* dsp descriptor */
+	int devno;				/* PCM or RECLEV */
+};
+
+/*
+ * Wrap the open dsp descriptor `fd`, which stays owned by the caller.
+ * Fails with ENODEV if the device does not have per-stream volume.
+ */
+struct mix_stream *
+mixer_stream_new(int fd)
+{
+	struct mix_stream *ms;
+	int mask, ramp;
+
+	/*
+	 * Only a dsp with per-stream volume answers SOUND_MIXER_RAMP; card
+	 * mixers, and dsp devices that pass mixer requests on to them, do
+	 * not. The device mask alone cannot tell a stream from the mixer of
+	 * a card that only has a PCM device.
+	 */
+	if (_mixer_fdioctl(fd, -1, MIXER_READ(SOUND_MIXER_RAMP), &ramp) < 0) {
+		errno = ENODEV;
+		return (NULL);
+	}
+	if (_mixer_fdioctl(fd, -1, SOUND_MIXER_READ_DEVMASK, &mask) < 0)
+		return (NULL);
+	if (mask != SOUND_MASK_PCM && mask != SOUND_MASK_RECLEV) {
+		errno = ENODEV;
+		return (NULL);
+	}
+	if ((ms = malloc(sizeof(struct mix_stream))) == NULL)
+		return (NULL);
+	ms->fd = fd;
+	ms->devno = mask == SOUND_MASK_PCM ?
+	    SOUND_MIXER_PCM : SOUND_MIXER_RECLEV;
+
+	return (ms);
+}
+
+/*
+ * Fetch the stream's volume.
+ */
+int
+mixer_stream_get_vol(struct mix_stream *ms, mix_volume_t *vol)
+{
+	int v;
+
+	if (_mixer_fdioctl(ms->fd, -1, MIXER_READ(ms->devno), &v) < 0)
+		return (-1);
+	vol->left = MIX_VOLNORM(v & 0x00ff);
+	vol->right = MIX_VOLNORM((v >> 8) & 0x00ff);
+
+	return (0);
+}
+
+/*
+ * Change the stream's volume. Like `mixer_set_vol`, the values have to be
+ * between MIX_VOLMIN and MIX_VOLMAX.
+ */
+int
+mixer_stream_set_vol(struct mix_stream *ms, mix_volume_t vol)
+{
+	int v;
+
+	if (vol.left < MIX_VOLMIN || vol.left > MIX_VOLMAX ||
+	    vol.right < MIX_VOLMIN || vol.right > MIX_VOLMAX) {
+		errno = ERANGE;
+		return (-1);
+	}
+	v = MIX_VOLDENORM(vol.left) | MIX_VOLDENORM(vol.right) << 8;
+
+	return (_mixer_fdioctl(ms->fd, -1, MIXER_WRITE(ms->devno), &v) < 0 ?
+	    -1 : 0);
+}
+
+/*
+ * Return 1 if the stream is muted, 0 if not.
+ */
+int
+mixer_stream_get_mute(struct mix_stream *ms)
+{
+	int v;
+
+	if (_mixer_fdioctl(ms->fd, -1, SOUND_MIXER_READ_MUTE, &v) < 0)
+		return (-1);
+
+	return (MIX_ISSET(ms->devno, v));
+}
+
+/*
+ * Mute or unmute the stream.
+ *
+ * @param opt		MIX_MUTE mute the stream
+ *			MIX_UNMUTE unmute the stream
+ *			MIX_TOGGLEMUTE toggle the stream's mute
+ */
+int
+mixer_stream_set_mute(struct mix_stream *ms, int opt)
+{
+	int v;
+
+	switch (opt) {
+	case MIX_MUTE:
+		v = 1;
+		break;
+	case MIX_UNMUTE:
+		v = 0;
+		break;
+	case MIX_TOGGLEMUTE:
+		if ((v = mixer_stream_get_mute(ms)) < 0)
+			return (-1);
+		v = !v;
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	v = v ? 1 << ms->devno : 0;
+
+	return (_mixer_fdioctl(ms->fd, -1, SOUND_MIXER_WRITE_MUTE, &v) < 0 ?
+	    -1 : 0);
+}
+
+/*
+ * Spread later volume changes of the stream over `msec` milliseconds, or
+ * apply them at once if it is 0.
+ */
+int
+mixer_stream_set_ramp(struct mix_stream *ms, int msec)
+{
+	if (msec < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (_mixer_fdioctl(ms->fd, -1, MIXER_WRITE(SOUND_MIXER_RAMP),
+	    &msec) < 0 ? -1 : 0);
+}
+
+/*
+ * Free the stream. The descriptor is left open.
+ */
+void
+mixer_stream_free(struct mix_stream *ms)
+{
+	free(ms);
+}
@@ -0,0 +1,70 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * The FreeBSD library functions the tree uses that Linux does not have.
+ */
+
+#include <sys/sysctl.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char *program_invocation_short_name;
+
+#ifdef COMPAT_STRLCPY
+size_t
+strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len;
+
+	len = strlen(src);
+	if (size > 0) {
+		if (len < size)
+			memcpy(dst, src, len + 1);
+		else {
+			memcpy(dst, src, size - 1);
+			dst[size - 1] = '\0';
+		}
+	}
+
+	return (len);
+}
+#endif
+
+const char *
+getprogname(void)
+{
+	return (program_invocation_short_name);
+}
+
+int
+sysctlbyname(const char *name __unused, void *old __unused,
+    size_t *oldlen __unused, const void *new __unused, size_t newlen __unused)
+{
+	errno = ENOENT;
+
+	return (-1);
+}
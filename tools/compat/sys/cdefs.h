@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * The FreeBSD additions to <sys/cdefs.h> the tree uses, on top of the
+ * system's own. nitems() comes from <sys/param.h> on FreeBSD, but not every
+ * file that uses it includes that.
+ */
+
+#ifndef _COMPAT_SYS_CDEFS_H_
+#define _COMPAT_SYS_CDEFS_H_
+
+#include_next <sys/cdefs.h>
+
+#ifndef __dead2
+#define	__dead2		__attribute__((__noreturn__))
+#endif
+#ifndef __unused
+#define	__unused	__attribute__((__unused__))
+#endif
+#ifndef __printflike
+#define	__printflike(fmtarg, firstvararg)				\
+	__attribute__((__format__(__printf__, fmtarg, firstvararg)))
+#endif
+#ifndef __predict_true
+#define	__predict_true(exp)	__builtin_expect((exp), 1)
+#define	__predict_false(exp)	__builtin_expect((exp), 0)
+#endif
+#ifndef __DECONST
+#define	__DECONST(type, var)	((type)(__UINTPTR_TYPE__)(const void *)(var))
+#endif
+#ifndef __sym_compat
+#define	__sym_compat(sym, impl, verid)					\
+	__asm__(".symver " #impl ", " #sym "@" #verid)
+#endif
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#endif /* _COMPAT_SYS_CDEFS_H_ */
@@ -0,0 +1,125 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * The parts of FreeBSD's <sys/soundcard.h> that Linux's OSS 3 header lacks:
+ * the OSS 4 information requests and the FreeBSD additions the tree uses,
+ * including those of patches/mixer_kern.diff. The layouts follow FreeBSD's
+ * header.
+ */
+
+#ifndef _COMPAT_SYS_SOUNDCARD_H_
+#define _COMPAT_SYS_SOUNDCARD_H_
+
+#include_next <sys/soundcard.h>
+
+#define	SOUND_MIXER_MUTE	28	/* 0 or 1 */
+#define	SOUND_MIXER_READ_MUTE	MIXER_READ(SOUND_MIXER_MUTE)
+#define	SOUND_MIXER_WRITE_MUTE	MIXER_WRITE(SOUND_MIXER_MUTE)
+
+#ifndef AFMT_S32_LE
+#define	AFMT_S32_LE	0x00001000	/* Little endian signed 32-bit */
+#define	AFMT_S32_BE	0x00002000	/* Big endian signed 32-bit */
+#define	AFMT_S24_LE	0x00010000	/* Little endian signed 24-bit */
+#define	AFMT_S24_BE	0x00020000	/* Big endian signed 24-bit */
+#endif
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define	AFMT_S24_NE	AFMT_S24_LE
+#define	AFMT_S32_NE	AFMT_S32_LE
+#else
+#define	AFMT_S24_NE	AFMT_S24_BE
+#define	AFMT_S32_NE	AFMT_S32_BE
+#endif
+
+/* From patches/mixer_kern.diff. */
+#define	SOUND_MIXER_STEP	0xf0	/* relative volume change */
+#define	SOUND_MIXER_RAMP	0xf1	/* stream volume ramp, in ms */
+struct snd_mixer_state {
+	int devmask;
+	int recmask;
+	int recsrc;
+	int mutedevs;
+	int modify_counter;
+	int level[SOUND_MIXER_NRDEVICES];	/* left | right << 8 */
+};
+#define	SOUND_MIXER_READ_STATE	_IOR('M', 0xf2, struct snd_mixer_state)
+
+/* The group of an ioctl request, from FreeBSD's <sys/ioccom.h>. */
+#define	IOCGROUP(x)	(((x) >> 8) & 0xff)
+
+typedef struct oss_sysinfo {
+	char product[32];
+	char version[32];
+	int versionnum;
+	char options[512];
+	int numaudios;
+	int openedaudio[8];
+	int numsynths;
+	int nummidis;
+	int numtimers;
+	int nummixers;
+	int openedmidi[8];
+	int numcards;
+	int numaudioengines;
+	char license[16];
+	char revision_info[256];
+	int filler[172];
+} oss_sysinfo;
+
+typedef struct oss_mixerinfo {
+	int dev;
+	char id[16];
+	char name[32];
+	int modify_counter;
+	int card_number;
+	int port_number;
+	char handle[32];
+	int magic;
+	int enabled;
+	int caps;
+	int flags;
+	int nrext;
+	int priority;
+	char devnode[32];
+	int legacy_device;
+	int filler[245];
+} oss_mixerinfo;
+
+typedef struct oss_card_info {
+	int card;
+	char shortname[16];
+	char longname[128];
+	int flags;
+	char hw_info[400];
+	int intr_count;
+	int ack_count;
+	int filler[154];
+} oss_card_info;
+
+#define	SNDCTL_SYSINFO		_IOR('X', 1, oss_sysinfo)
+#define	OSS_SYSINFO		SNDCTL_SYSINFO
+#define	SNDCTL_MIXERINFO	_IOWR('X', 10, oss_mixerinfo)
+#define	SNDCTL_CARDINFO		_IOWR('X', 11, oss_card_info)
+
+#endif /* _COMPAT_SYS_SOUNDCARD_H_ */
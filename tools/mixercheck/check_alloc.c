@@ -0,0 +1,231 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * mixer_open_into() must not allocate: the allocator is interposed here and
+ * aborts while the trap is set. Outside of it, calls are passed on to the
+ * C library; a small arena serves the ones made while looking that up.
+ */
+
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include <dlfcn.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mixer.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mixercheck.h"
+
+#define ARENASIZE	4096
+#define NCTL		4
+
+static int trap;
+static int resolving;
+static union {
+	char buf[ARENASIZE];
+	max_align_t align;
+} arena;
+static size_t arenaused;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static void resolve(void);
+static void *arena_alloc(size_t);
+static int run(void (*)(void));
+static void openinto(void);
+static void misaligned(void);
+
+static union {
+	char buf[8192];
+	void *align;
+} storage;
+
+void
+check_alloc(void)
+{
+	int rc;
+
+	check(mixer_open_size(NCTL) <= sizeof(storage.buf),
+	    "the test buffer is large enough (%zu bytes needed)",
+	    mixer_open_size(NCTL));
+	rc = run(openinto);
+	check(rc == 0, "opening, using and closing a mixer in a buffer does "
+	    "not allocate (%s %d)", rc < 0 ? "signal" : "exit", abs(rc));
+	rc = run(misaligned);
+	check(rc == 0, "a misaligned buffer fails with EINVAL without "
+	    "touching it (%s %d)", rc < 0 ? "signal" : "exit", abs(rc));
+}
+
+/*
+ * Run `fn` in a child with the trap set, and return its exit status, or
+ * minus the signal that killed it, e.g. SIGABRT from the trap.
+ */
+static int
+run(void (*fn)(void))
+{
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		trap = 1;
+		fn();
+		trap = 0;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		err(1, "waitpid");
+
+	return (WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+}
+
+static void
+openinto(void)
+{
+	static const char *names[NCTL] = { "volume", "mute", "recsrc",
+	    "ramp" };
+	struct mixer *m;
+	mix_volume_t vol;
+	int i;
+
+	m = mixer_open_into(storage.buf, mixer_open_size(NCTL), "/dev/mixer0");
+	if (m == NULL)
+		_exit(2);
+	for (i = 0; i < NCTL; i++) {
+		if (mixer_add_ctl(m->dev, i, names[i], NULL, NULL) < 0)
+			_exit(3);
+	}
+	vol.left = vol.right = 0.5f;
+	if (mixer_set_vol(m, vol) < 0 || mixer_refresh(m) < 0)
+		_exit(4);
+	if (mixer_close(m) < 0)
+		_exit(5);
+}
+
+/*
+ * Leave a descriptor where the misaligned handle would keep `fd`: it must
+ * still be open afterwards.
+ */
+static void
+misaligned(void)
+{
+	char *p = storage.buf + 1;
+	int fd;
+
+	if ((fd = dup(STDIN_FILENO)) < 0)
+		_exit(2);
+	memcpy(p + offsetof(struct mixer, fd), &fd, sizeof(fd));
+	if (mixer_open_into(p, sizeof(storage.buf) - 1, "/dev/mixer0") !=
+	    NULL || errno != EINVAL)
+		_exit(3);
+	if (fcntl(fd, F_GETFD) < 0)
+		_exit(4);
+}
+
+static void
+resolve(void)
+{
+	resolving = 1;
+	real_malloc = (void *(*)(size_t))dlsym(RTLD_NEXT, "malloc");
+	real_calloc = (void *(*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+	real_realloc = (void *(*)(void *, size_t))dlsym(RTLD_NEXT, "realloc");
+	real_free = (void (*)(void *))dlsym(RTLD_NEXT, "free");
+	resolving = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_free == NULL)
+		abort();
+}
+
+static void *
+arena_alloc(size_t size)
+{
+	void *p;
+
+	size = roundup(size, sizeof(max_align_t));
+	if (arenaused + size > sizeof(arena.buf))
+		return (NULL);
+	p = arena.buf + arenaused;
+	arenaused += size;
+
+	return (p);
+}
+
+void *
+malloc(size_t size)
+{
+	if (trap)
+		abort();
+	if (resolving)
+		return (arena_alloc(size));
+	if (real_malloc == NULL)
+		resolve();
+
+	return (real_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	if (trap)
+		abort();
+	/* The arena is zeroed and never reused. */
+	if (resolving)
+		return (arena_alloc(n * size));
+	if (real_calloc == NULL)
+		resolve();
+
+	return (real_calloc(n, size));
+}
+
+void *
+realloc(void *p, size_t size)
+{
+	if (trap)
+		abort();
+	if (real_realloc == NULL)
+		resolve();
+
+	return (real_realloc(p, size));
+}
+
+void
+free(void *p)
+{
+	if ((char *)p >= arena.buf && (char *)p < arena.buf + sizeof(arena.buf))
+		return;
+	if (real_free == NULL)
+		resolve();
+	real_free(p);
+}
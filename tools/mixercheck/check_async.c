@@ -0,0 +1,169 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Asynchronous operations against a slow driver: the order of the
+ * operations on a device, the parallelism between devices, cancellation,
+ * and mask updates from several workers at once.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mixercheck.h"
+
+#define NOPS		8
+#define DELAY		2000			/* microseconds per ioctl */
+
+static void reap(struct mixer *, mix_op_t **, int);
+static void submit(struct mixer *, mix_op_t *, int, int, float);
+
+void
+check_async(void)
+{
+	static const int devs[] = { SOUND_MIXER_VOLUME, SOUND_MIXER_PCM,
+	    SOUND_MIXER_LINE, SOUND_MIXER_MIC };
+	mix_op_t ops[2][NOPS], mute[4], *done[2 * NOPS];
+	struct mixer *m;
+	double t;
+	int i, j, k, last[2], ok, mask;
+
+	if ((m = mixer_open("/dev/mixer0")) == NULL)
+		err(1, "mixer_open");
+	(void)sim_setopt("delay", DELAY);
+
+	/* Interleave the operations on two devices. */
+	t = now();
+	for (i = 0; i < NOPS; i++) {
+		for (j = 0; j < 2; j++)
+			submit(m, &ops[j][i], MIX_OP_SETVOL, devs[j],
+			    (i + 1) / 10.0f);
+	}
+	reap(m, done, 2 * NOPS);
+	t = now() - t;
+	ok = 1;
+	last[0] = last[1] = -1;
+	for (k = 0; k < 2 * NOPS; k++) {
+		j = done[k]->devno == devs[0] ? 0 : 1;
+		i = done[k] - ops[j];
+		if (done[k]->error != 0 || i != last[j] + 1)
+			ok = 0;
+		last[j] = i;
+	}
+	check(ok, "operations on a device complete in submission order");
+	check(samevol(m, devs[0], NOPS / 10.0f, NOPS / 10.0f) &&
+	    samevol(m, devs[1], NOPS / 10.0f, NOPS / 10.0f),
+	    "the last operation on a device wins");
+	/* Each operation is a write and a read back. */
+	check(t < 0.75 * 2 * NOPS * 2 * DELAY / 1e6,
+	    "devices proceed in parallel (%.1f ms, %.1f ms one at a time)",
+	    t * 1e3, 2 * NOPS * 2 * DELAY / 1e3);
+
+	for (i = 0; i < NOPS; i++)
+		submit(m, &ops[0][i], MIX_OP_SETVOL, devs[1], (i + 1) / 20.0f);
+	/* Let the first operation start. */
+	(void)usleep(DELAY / 2);
+	check(mixer_cancel(m, &ops[0][0]) < 0 && errno == EBUSY,
+	    "a running operation cannot be cancelled");
+	check(mixer_cancel(m, &ops[0][3]) == 0 &&
+	    mixer_cancel(m, &ops[0][NOPS - 1]) == 0,
+	    "pending operations can be cancelled");
+	reap(m, done, NOPS);
+	ok = 1;
+	last[0] = -1;
+	for (k = 0; k < NOPS; k++) {
+		i = done[k] - ops[0];
+		if (i == 3 || i == NOPS - 1) {
+			if (done[k]->error != ECANCELED)
+				ok = 0;
+			continue;
+		}
+		if (done[k]->error != 0 || i < last[0])
+			ok = 0;
+		last[0] = i;
+	}
+	check(ok, "cancelled operations complete with ECANCELED, "
+	    "the others in order");
+	check(mixer_refresh(m) == 0 && samevol(m, devs[1], (NOPS - 1) / 20.0f,
+	    (NOPS - 1) / 20.0f), "cancelled operations are not executed");
+	check(mixer_cancel(m, &ops[0][1]) < 0 && errno == EBUSY,
+	    "a completed operation cannot be cancelled");
+
+	/* Every device has its own worker, but they share the mute mask. */
+	for (i = 0; i < (int)nitems(devs); i++) {
+		memset(&mute[i], 0, sizeof(mute[i]));
+		mute[i].type = MIX_OP_SETMUTE;
+		mute[i].devno = devs[i];
+		mute[i].opt = MIX_MUTE;
+		if (mixer_submit(m, &mute[i]) < 0)
+			err(1, "mixer_submit");
+	}
+	reap(m, done, nitems(devs));
+	for (i = 0, mask = 0; i < (int)nitems(devs); i++)
+		mask |= 1 << devs[i];
+	check(mixer_refresh(m) == 0 && (m->mutemask & mask) == mask,
+	    "concurrent mute changes are all kept");
+	(void)mixer_set_mutemask(m, mask, MIX_UNMUTE);
+
+	(void)sim_setopt("delay", 0);
+	(void)mixer_close(m);
+}
+
+static void
+submit(struct mixer *m, mix_op_t *op, int type, int devno, float vol)
+{
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->devno = devno;
+	op->vol.left = op->vol.right = vol;
+	if (mixer_submit(m, op) < 0)
+		err(1, "mixer_submit");
+}
+
+/*
+ * Wait for `n` operations to complete and store them in completion order.
+ */
+static void
+reap(struct mixer *m, mix_op_t **done, int n)
+{
+	struct pollfd pfd;
+	mix_op_t *op;
+	int i = 0;
+
+	pfd.fd = mixer_get_compfd(m);
+	pfd.events = POLLIN;
+	while (i < n) {
+		if (poll(&pfd, 1, 5000) == 0)
+			errx(1, "operations did not complete");
+		while (i < n && (op = mixer_complete(m)) != NULL)
+			done[i++] = op;
+	}
+}
@@ -0,0 +1,131 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Coalesced volume updates against a clock the check steps by hand, so
+ * that what gets written, and when, is deterministic.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+#define MAXRATE		10			/* flushes per second */
+#define PERIOD		(1000000 / MAXRATE)	/* microseconds */
+
+static int64_t fakeclock(void *);
+static int stats(struct mix_coalesce *, unsigned long, unsigned long,
+    unsigned long);
+static mix_volume_t vol(float);
+
+void
+check_coalesce(void)
+{
+	struct mix_coalesce *c;
+	struct mix_dev *pcm;
+	struct mixer *m;
+	int64_t t = 0;
+	int rc;
+
+	if ((m = mixer_open("/dev/mixer0")) == NULL)
+		err(1, "mixer_open");
+	if ((pcm = mixer_get_dev(m, SOUND_MIXER_PCM)) == NULL)
+		err(1, "mixer_get_dev");
+	if ((c = mixer_coalesce_new(m, MAXRATE, fakeclock, &t)) == NULL)
+		err(1, "mixer_coalesce_new");
+
+	check(mixer_coalesce_set_vol(c, pcm, vol(0.1f)) == 1 &&
+	    samevol(m, SOUND_MIXER_PCM, 0.1f, 0.1f) && stats(c, 0, 0, 1),
+	    "the first update is written right away");
+	check(mixer_coalesce_set_vol(c, pcm, vol(0.2f)) == 0 &&
+	    mixer_coalesce_set_vol(c, pcm, vol(0.3f)) == 0 &&
+	    samevol(m, SOUND_MIXER_PCM, 0.1f, 0.1f) && stats(c, 1, 0, 1),
+	    "updates within a period are held back and merged");
+	t += PERIOD / 2;
+	check(mixer_coalesce_timeout(c) == PERIOD / 2 / 1000 &&
+	    mixer_coalesce_poll(c) == 0, "nothing is flushed before the "
+	    "period is over");
+	t += PERIOD / 2;
+	check(mixer_coalesce_timeout(c) == 0 && mixer_coalesce_poll(c) == 1 &&
+	    samevol(m, SOUND_MIXER_PCM, 0.3f, 0.3f) && stats(c, 1, 0, 2) &&
+	    mixer_coalesce_timeout(c) == -1,
+	    "the last update is written once the period is over");
+	t += PERIOD;
+	check(mixer_coalesce_set_vol(c, pcm, vol(0.301f)) == 0 &&
+	    stats(c, 1, 1, 2) && mixer_coalesce_timeout(c) == -1,
+	    "an update to the same levels is dropped");
+
+	/* A failed write stays pending and is retried. */
+	t += PERIOD;
+	(void)sim_setopt("nowrite", 1);
+	rc = mixer_coalesce_set_vol(c, pcm, vol(0.5f));
+	check(rc < 0 && errno == EIO && mixer_coalesce_timeout(c) > 0,
+	    "a failed write is reported and stays pending");
+	(void)sim_setopt("nowrite", 0);
+	check(mixer_coalesce_poll(c) == 0, "it is not retried before the "
+	    "period is over");
+	t += PERIOD;
+	check(mixer_coalesce_poll(c) == 1 &&
+	    samevol(m, SOUND_MIXER_PCM, 0.5f, 0.5f) &&
+	    mixer_coalesce_timeout(c) == -1 && stats(c, 1, 1, 4),
+	    "the next flush writes it");
+
+	mixer_coalesce_free(c);
+	(void)mixer_close(m);
+}
+
+static int64_t
+fakeclock(void *arg)
+{
+	return (*(int64_t *)arg);
+}
+
+static int
+stats(struct mix_coalesce *c, unsigned long merged, unsigned long dropped,
+    unsigned long issued)
+{
+	struct mix_coalesce_stats st;
+
+	mixer_coalesce_stats(c, &st);
+
+	return (st.merged == merged && st.dropped == dropped &&
+	    st.issued == issued);
+}
+
+static mix_volume_t
+vol(float v)
+{
+	mix_volume_t vol;
+
+	vol.left = vol.right = v;
+
+	return (vol);
+}
@@ -0,0 +1,145 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+/*
+ * The FBSD_1.7 symbols, as a binary linked before the names of devices and
+ * controls became pointers calls them: with the layout it was built with.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <err.h>
+#include <mixer.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+struct dev17;
+
+struct ctl17 {
+	struct dev17 *parent_dev;
+	int id;
+	char name[NAME_MAX];
+	int (*mod)(struct dev17 *, void *);
+	int (*print)(struct dev17 *, void *);
+	TAILQ_ENTRY(ctl17) ctls;
+};
+
+struct dev17 {
+	struct mixer17 *parent_mixer;
+	char name[NAME_MAX];
+	int devno;
+	mix_volume_t vol;
+	int nctl;
+	TAILQ_HEAD(, ctl17) ctls;
+	TAILQ_ENTRY(dev17) devs;
+};
+
+struct mixer17 {
+	TAILQ_HEAD(, dev17) devs;
+	struct dev17 *dev;
+	oss_mixerinfo mi;
+	oss_card_info ci;
+	char name[NAME_MAX];
+	int fd;
+	int unit;
+	int ndev;
+	int devmask;
+	int mutemask;
+	int recmask;
+	int recsrc;
+	int mode;
+	int f_default;
+};
+
+struct mixer17 *open17(const char *);
+int close17(struct mixer17 *);
+struct dev17 *get_dev_byname17(struct mixer17 *, const char *);
+int add_ctl17(struct dev17 *, int, const char *,
+    int (*)(struct dev17 *, void *), int (*)(struct dev17 *, void *));
+struct ctl17 *get_ctl_byname17(struct dev17 *, const char *);
+int set_vol17(struct mixer17 *, mix_volume_t);
+int set_mute17(struct mixer17 *, int);
+
+__sym_compat(mixer_open, open17, FBSD_1.7);
+__sym_compat(mixer_close, close17, FBSD_1.7);
+__sym_compat(mixer_get_dev_byname, get_dev_byname17, FBSD_1.7);
+__sym_compat(mixer_add_ctl, add_ctl17, FBSD_1.7);
+__sym_compat(mixer_get_ctl_byname, get_ctl_byname17, FBSD_1.7);
+__sym_compat(mixer_set_vol, set_vol17, FBSD_1.7);
+__sym_compat(mixer_set_mute, set_mute17, FBSD_1.7);
+
+static int modctl(struct dev17 *, void *);
+
+static int nmod;
+
+void
+check_compat(void)
+{
+	const char *names[SOUND_MIXER_NRDEVICES] = SOUND_DEVICE_NAMES;
+	struct mixer17 *m;
+	struct dev17 *d;
+	struct ctl17 *cp;
+	mix_volume_t vol;
+	int ok;
+
+	if ((m = open17("/dev/mixer0")) == NULL)
+		err(1, "mixer_open@FBSD_1.7");
+	ok = m->ndev > 0 && m->dev == TAILQ_FIRST(&m->devs) &&
+	    strcmp(m->name, "/dev/mixer0") == 0;
+	TAILQ_FOREACH(d, &m->devs, devs) {
+		if (d->parent_mixer != m || strcmp(d->name, names[d->devno]))
+			ok = 0;
+	}
+	check(ok, "devices are laid out as in FBSD_1.7");
+
+	if ((d = get_dev_byname17(m, "pcm")) == NULL)
+		err(1, "mixer_get_dev_byname@FBSD_1.7");
+	nmod = 0;
+	check(add_ctl17(d, 1, "ctl", modctl, NULL) == 0 &&
+	    (cp = get_ctl_byname17(d, "ctl")) != NULL &&
+	    cp->parent_dev == d && strcmp(cp->name, "ctl") == 0 &&
+	    cp->mod(cp->parent_dev, NULL) == 0 && nmod == 1,
+	    "controls are laid out as in FBSD_1.7");
+
+	m->dev = d;
+	vol.left = 0.25f;
+	vol.right = 0.5f;
+	check(set_vol17(m, vol) == 0 &&
+	    MIX_VOLDENORM(d->vol.left) == 25 &&
+	    MIX_VOLDENORM(d->vol.right) == 50 &&
+	    set_mute17(m, MIX_MUTE) == 0 && MIX_ISMUTE(m, d->devno) &&
+	    set_mute17(m, MIX_UNMUTE) == 0 && !MIX_ISMUTE(m, d->devno),
+	    "volume and mute are set through the selected device");
+	(void)close17(m);
+}
+
+static int
+modctl(struct dev17 *d __unused, void *p __unused)
+{
+	nmod++;
+
+	return (0);
+}
@@ -0,0 +1,180 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Typed controls: mixer_add_ctl_typed(), value checks in mixer_ctl_set()
+ * and the batch calls, on allocated and mixer_open_into() handles, and
+ * mixer_add_ctl_s() ignoring anything past the fields it always took.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+#define C_LEVEL		1
+#define C_MODE		2
+#define C_PLAIN		3
+
+static const char *const modes[] = { "off", "low", "high" };
+static const struct mix_ctltype t_level = {
+	.type = MIX_CTL_RANGE, .min = -10, .max = 10
+};
+static const struct mix_ctltype t_mode = {
+	.type = MIX_CTL_ENUM, .nitems = nitems(modes), .items = modes
+};
+static const struct mix_ctltype t_bad = { .type = MIX_CTL_RANGE,
+	.min = 1, .max = 0
+};
+
+/* Values of the controls, per device number. */
+static int levels[SOUND_MIXER_NRDEVICES];
+static int plainmod;
+
+static void typed(struct mixer *, const char *);
+static int getlevel(struct mix_dev *, mix_ctlval_t *);
+static int setlevel(struct mix_dev *, const mix_ctlval_t *);
+static int modplain(struct mix_dev *, void *);
+
+void
+check_ctl(void)
+{
+	struct mixer *m;
+	void *buf;
+	size_t size;
+
+	if ((m = mixer_open("/dev/mixer0")) == NULL)
+		err(1, "mixer_open");
+	typed(m, "mixer_open");
+	(void)mixer_close(m);
+
+	size = mixer_open_size(3 * SOUND_MIXER_NRDEVICES);
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	if ((m = mixer_open_into(buf, size, "/dev/mixer0")) == NULL)
+		err(1, "mixer_open_into");
+	typed(m, "mixer_open_into");
+	(void)mixer_close(m);
+	free(buf);
+}
+
+static void
+typed(struct mixer *m, const char *how)
+{
+	struct mix_ctlreq req[2];
+	struct mix_dev *d, *d2;
+	mix_ctl_t ctl, *cp, *mode;
+	mix_ctlval_t v;
+
+	d = mixer_dev_next(m, NULL);
+	d2 = mixer_dev_next(m, d);
+	if (d == NULL || d2 == NULL)
+		errx(1, "%s: need two devices", how);
+	memset(levels, 0, sizeof(levels));
+
+	check(mixer_add_ctl_typed(d, C_LEVEL, "level", NULL, getlevel,
+	    setlevel) < 0 && errno == EINVAL &&
+	    mixer_add_ctl_typed(d, C_LEVEL, "level", &t_bad, getlevel,
+	    setlevel) < 0 && errno == EINVAL &&
+	    mixer_get_ctl(d, C_LEVEL) == NULL,
+	    "%s: a missing or empty type is refused", how);
+
+	if (mixer_add_ctl_typed(d, C_LEVEL, "level", &t_level, getlevel,
+	    setlevel) < 0 ||
+	    mixer_add_ctl_typed(d2, C_LEVEL, "level", &t_level, getlevel,
+	    setlevel) < 0 ||
+	    mixer_add_ctl_typed(d, C_MODE, "mode", &t_mode, NULL, NULL) < 0)
+		err(1, "%s: mixer_add_ctl_typed", how);
+	cp = mixer_get_ctl(d, C_LEVEL);
+	mode = mixer_get_ctl(d, C_MODE);
+
+	v.i = 7;
+	check(mixer_ctl_set(cp, &v) == 0 && levels[d->devno] == 7 &&
+	    mixer_ctl_get(cp, &v) == 0 && v.i == 7,
+	    "%s: a range control is set and read back", how);
+	v.i = 11;
+	check(mixer_ctl_set(cp, &v) < 0 && errno == ERANGE &&
+	    levels[d->devno] == 7,
+	    "%s: an out of range value is refused", how);
+	v.e = 1;
+	check(mixer_ctl_set(mode, &v) < 0 && errno == EOPNOTSUPP &&
+	    mixer_ctl_get(mode, &v) < 0 && errno == EOPNOTSUPP,
+	    "%s: a control without callbacks fails with EOPNOTSUPP", how);
+
+	req[0].ctl = cp;
+	req[0].val.i = 20;
+	req[1].ctl = mixer_get_ctl(d2, C_LEVEL);
+	req[1].val.i = -3;
+	check(mixer_ctl_set_many(req, 2) < 0 && errno == ERANGE &&
+	    req[0].error == ERANGE && req[1].error == 0 &&
+	    levels[d->devno] == 7 && levels[d2->devno] == -3,
+	    "%s: a batch set records a per-request error", how);
+	check(mixer_ctl_get_many(req, 2) == 0 && req[0].val.i == 7 &&
+	    req[1].val.i == -3,
+	    "%s: a batch get reads every device", how);
+
+	/* Typed fields a caller's structure does not have must not matter. */
+	memset(&ctl, 0xa5, sizeof(ctl));
+	ctl.id = C_PLAIN;
+	ctl.name = "plain";
+	ctl.mod = modplain;
+	ctl.print = NULL;
+	ctl.parent_dev = d;
+	plainmod = 0;
+	check(mixer_add_ctl_s(&ctl) == 0 &&
+	    (cp = mixer_get_ctl(d, C_PLAIN)) != NULL &&
+	    cp->mod(cp->parent_dev, NULL) == 0 && plainmod == 1 &&
+	    mixer_ctl_get(cp, &v) < 0 && errno == EINVAL,
+	    "%s: mixer_add_ctl_s adds an untyped control", how);
+}
+
+static int
+getlevel(struct mix_dev *d, mix_ctlval_t *v)
+{
+	v->i = levels[d->devno];
+
+	return (0);
+}
+
+static int
+setlevel(struct mix_dev *d, const mix_ctlval_t *v)
+{
+	levels[d->devno] = v->i;
+
+	return (0);
+}
+
+static int
+modplain(struct mix_dev *d __unused, void *p __unused)
+{
+	plainmod++;
+
+	return (0);
+}
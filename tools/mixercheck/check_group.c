@@ -0,0 +1,106 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Groups over all units when the unit numbers have a gap, and units that
+ * exist but cannot be opened.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+#define NUNITS		4
+
+static int called[NUNITS];
+
+static int count(struct mixer *, int, void *);
+
+void
+check_group(void)
+{
+	struct mix_group *g;
+	int errs[NUNITS], units[2] = { 0, 6 };
+	int i, n, ok;
+
+	if (sim_setopt("units", NUNITS) < 0)
+		err(1, "mixersim_setopt");
+	(void)sim_detach(1);
+
+	if ((g = mixer_group_open(NULL, 0)) == NULL)
+		err(1, "mixer_group_open");
+	n = mixer_group_count(g);
+	ok = n == NUNITS - 1;
+	for (i = 0; ok && i < n; i++) {
+		ok = mixer_group_get(g, i) != NULL &&
+		    mixer_group_unit(g, i) == (i == 0 ? 0 : i + 1) &&
+		    mixer_group_get(g, i)->unit == mixer_group_unit(g, i);
+	}
+	check(ok, "all units are found past a detached one (%d of %d)", n,
+	    NUNITS - 1);
+	(void)mixer_group_close(g);
+
+	(void)sim_setopt("busy", 1 << 2);
+	if ((g = mixer_group_open(NULL, 0)) == NULL)
+		err(1, "mixer_group_open");
+	check(mixer_group_count(g) == NUNITS - 1 &&
+	    mixer_group_get(g, 1) == NULL && errno == EBUSY &&
+	    mixer_group_unit(g, 1) == 2 && mixer_group_get(g, 2) != NULL,
+	    "a unit that cannot be opened stays in the group with its error");
+	memset(called, 0, sizeof(called));
+	check(mixer_group_apply(g, count, NULL, errs) < 0 && errno == EBUSY &&
+	    errs[0] == 0 && errs[1] == EBUSY && errs[2] == 0 &&
+	    called[0] == 1 && called[1] == 0 && called[2] == 1,
+	    "apply skips it and reports the error of its open");
+	(void)mixer_group_close(g);
+
+	if ((g = mixer_group_open(units, nitems(units))) == NULL)
+		err(1, "mixer_group_open");
+	check(mixer_group_get(g, 0) != NULL && mixer_group_get(g, 1) == NULL &&
+	    mixer_group_unit(g, 1) == 6,
+	    "a listed unit that does not exist is kept with its error");
+	(void)mixer_group_close(g);
+
+	units[0] = 2;
+	check(mixer_group_open(units, 1) == NULL && errno == EBUSY,
+	    "a group none of whose units can be opened fails");
+
+	(void)sim_setopt("busy", 0);
+	(void)sim_attach(1);
+	(void)sim_setopt("units", 1);
+}
+
+static int
+count(struct mixer *m __unused, int i, void *arg __unused)
+{
+	called[i]++;
+
+	return (0);
+}
@@ -0,0 +1,193 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Meters fed the same synthetic period in one piece, which goes mostly
+ * through the vectorized kernels, a frame at a time, which only goes
+ * through the scalar tail, and in chunks of varying size, have to agree.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <mixer.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+#define RATE		48000
+#define INTERVAL	10			/* milliseconds */
+#define NFRAMES		(RATE * INTERVAL / 1000)
+
+static unsigned int fill(uint8_t *, int, int, int);
+static int feed(int, int, int, const uint8_t *, size_t,
+    struct mix_level *);
+
+void
+check_meter(void)
+{
+	static const struct {
+		const char *name;
+		int fmt;
+		int bps;
+	} fmts[] = {
+		{ "s16", AFMT_S16_NE, 2 },
+		{ "s24", AFMT_S24_NE, 3 },
+		{ "s32", AFMT_S32_NE, 4 },
+	};
+	static const int nchans[] = { 1, 2, 6 };
+	static uint8_t buf[NFRAMES * 6 * 4];
+	struct mix_level lv[3][6];
+	struct mix_meter *mm;
+	unsigned int clips;
+	size_t len;
+	int f, i, c, k, ok;
+
+	for (f = 0; f < (int)nitems(fmts); f++) {
+		for (i = 0; i < (int)nitems(nchans); i++) {
+			clips = fill(buf, fmts[f].bps, nchans[i], NFRAMES);
+			len = (size_t)NFRAMES * nchans[i] * fmts[f].bps;
+			ok = 1;
+			for (k = 0; k < 3; k++) {
+				if (feed(k, fmts[f].fmt, nchans[i], buf, len,
+				    lv[k]) < 0)
+					ok = 0;
+			}
+			for (c = 0; ok && c < nchans[i]; c++) {
+				for (k = 1; k < 3; k++) {
+					if (lv[k][c].peak != lv[0][c].peak ||
+					    lv[k][c].clips != lv[0][c].clips ||
+					    fabsf(lv[k][c].rms - lv[0][c].rms) >
+					    1e-5f * lv[0][c].rms)
+						ok = 0;
+				}
+				clips -= lv[0][c].clips;
+			}
+			check(ok && clips == 0, "%s, %d channel(s): body and "
+			    "tail agree on peak, RMS and clips", fmts[f].name,
+			    nchans[i]);
+		}
+	}
+
+	if ((mm = mixer_meter_new(AFMT_S16_NE, 2, RATE, INTERVAL, 1)) == NULL)
+		err(1, "mixer_meter_new");
+	memset(lv, 0xa5, sizeof(lv));
+	check(mixer_meter_get(mm, lv[0], -1) < 0 && errno == EINVAL &&
+	    memcmp(lv[0], lv[1], sizeof(lv[0])) == 0,
+	    "a negative channel count fails with EINVAL");
+	(void)mixer_meter_close(mm);
+}
+
+/*
+ * Fill `buf` with `n` frames of noise with some samples at, and just below,
+ * full scale, and return the number of samples at full scale.
+ */
+static unsigned int
+fill(uint8_t *buf, int bps, int nchan, int n)
+{
+	uint32_t seed = 1;
+	int32_t x, max;
+	unsigned int clips = 0;
+	int i;
+
+	max = bps == 2 ? INT16_MAX : bps == 3 ? 8388607 : INT32_MAX;
+	for (i = 0; i < n * nchan; i++, buf += bps) {
+		seed = seed * 1103515245 + 12345;
+		switch (seed >> 28) {
+		case 0:
+			x = max;
+			break;
+		case 1:
+			x = -max - 1;
+			break;
+		case 2:
+			x = max - (seed >> 24 & 0x7);
+			break;
+		case 3:
+			x = -max + (seed >> 24 & 0x7);
+			break;
+		default:
+			x = (int32_t)seed >> (8 * (4 - bps));
+			break;
+		}
+		if (x == max || x == -max - 1)
+			clips++;
+		switch (bps) {
+		case 2:
+			*(int16_t *)buf = x;
+			break;
+		case 3:
+#if BYTE_ORDER == LITTLE_ENDIAN
+			buf[0] = x;
+			buf[1] = x >> 8;
+			buf[2] = x >> 16;
+#else
+			buf[0] = x >> 16;
+			buf[1] = x >> 8;
+			buf[2] = x;
+#endif
+			break;
+		default:
+			*(int32_t *)buf = x;
+			break;
+		}
+	}
+
+	return (clips);
+}
+
+/*
+ * Feed one period in one piece (way 0), a frame at a time (way 1), or in
+ * chunks of 1, 2, 3, ... frames (way 2), and get the result.
+ */
+static int
+feed(int way, int fmt, int nchan, const uint8_t *buf, size_t len,
+    struct mix_level *lv)
+{
+	struct mix_meter *mm;
+	size_t fsz, n, off;
+	int npub = 0;
+
+	if ((mm = mixer_meter_new(fmt, nchan, RATE, INTERVAL, 1)) == NULL)
+		err(1, "mixer_meter_new");
+	fsz = len / NFRAMES;
+	for (off = 0, n = 1; off < len; off += n * fsz, n++) {
+		if (way == 0)
+			n = NFRAMES;
+		else if (way == 1)
+			n = 1;
+		if (off + n * fsz > len)
+			n = (len - off) / fsz;
+		npub += mixer_meter_feed(mm, buf + off, n * fsz);
+	}
+	if (npub != 1 || mixer_meter_get(mm, lv, nchan) != nchan)
+		npub = -1;
+	(void)mixer_meter_close(mm);
+
+	return (npub);
+}
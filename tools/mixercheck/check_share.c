@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Handles from mixer_acquire(): one descriptor per unit, one state per unit
+ * that every handle sees, and no lock held while a unit is opened.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mixercheck.h"
+
+#define NTHREADS	8
+#define DELAY		2000			/* microseconds per ioctl */
+
+struct opener {
+	pthread_t thr;
+	int unit;
+	struct mixer *m;
+	double t;				/* time mixer_acquire took */
+};
+
+static void *opener(void *);
+
+void
+check_share(void)
+{
+	struct opener o[NTHREADS], slow;
+	struct mixer *a, *b;
+	struct mix_dev *d;
+	mix_volume_t v;
+	int i, ok;
+
+	if (sim_setopt("units", 2) < 0)
+		err(1, "mixersim_setopt");
+
+	/* Everyone acquiring the same unit at once. */
+	(void)sim_setopt("delay", DELAY);
+	for (i = 0; i < NTHREADS; i++) {
+		o[i].unit = 0;
+		if (pthread_create(&o[i].thr, NULL, opener, &o[i]) != 0)
+			errx(1, "pthread_create");
+	}
+	for (i = 0, ok = 1; i < NTHREADS; i++) {
+		(void)pthread_join(o[i].thr, NULL);
+		ok &= o[i].m != NULL && o[i].m->fd == o[0].m->fd;
+	}
+	(void)sim_setopt("delay", 0);
+	check(ok, "racing acquires of a unit share one descriptor");
+	for (i = 0; i < NTHREADS; i++) {
+		if (o[i].m != NULL)
+			(void)mixer_release(o[i].m);
+	}
+
+	/* A change through one handle shows in the others without a refresh. */
+	if ((a = mixer_acquire(0)) == NULL || (b = mixer_acquire(0)) == NULL)
+		err(1, "mixer_acquire");
+	d = mixer_get_dev(b, SOUND_MIXER_PCM);
+	a->dev = mixer_get_dev(a, SOUND_MIXER_PCM);
+	if (mixer_set_vol(a, (mix_volume_t){ 0.3f, 0.3f }) < 0)
+		err(1, "mixer_set_vol");
+	v = mixer_dev_vol(d);
+	check(MIX_VOLDENORM(v.left) == 30 && MIX_VOLDENORM(v.right) == 30 &&
+	    samevol(b, SOUND_MIXER_PCM, 0.3f, 0.3f),
+	    "a volume set through one handle is seen through another");
+	if (mixer_set_mute(a, MIX_MUTE) < 0)
+		err(1, "mixer_set_mute");
+	(void)mixer_get_dev(b, SOUND_MIXER_PCM);
+	ok = MIX_ISMUTE(b, SOUND_MIXER_PCM);
+	b->dev = d;
+	if (mixer_set_mute(b, MIX_UNMUTE) < 0)
+		err(1, "mixer_set_mute");
+	(void)mixer_get_dev(a, SOUND_MIXER_PCM);
+	check(ok && !MIX_ISMUTE(a, SOUND_MIXER_PCM),
+	    "and so is the mute, both ways");
+	(void)mixer_release(b);
+
+	/*
+	 * Opening unit 1 takes several slow ioctls; another handle to unit 0
+	 * meanwhile takes one, and must not wait for the open.
+	 */
+	(void)sim_setopt("delay", DELAY);
+	slow.unit = 1;
+	if (pthread_create(&slow.thr, NULL, opener, &slow) != 0)
+		errx(1, "pthread_create");
+	(void)usleep(DELAY / 2);
+	o[0].unit = 0;
+	(void)opener(&o[0]);
+	(void)pthread_join(slow.thr, NULL);
+	(void)sim_setopt("delay", 0);
+	check(o[0].m != NULL && slow.m != NULL && o[0].t < slow.t / 2,
+	    "acquiring an open unit does not wait for another unit's open "
+	    "(%.1f ms, open %.1f ms)", o[0].t * 1e3, slow.t * 1e3);
+	if (o[0].m != NULL)
+		(void)mixer_release(o[0].m);
+	if (slow.m != NULL)
+		(void)mixer_release(slow.m);
+
+	/* The last release closes the unit; the next acquire opens it. */
+	(void)mixer_release(a);
+	check((a = mixer_acquire(0)) != NULL && mixer_release(a) == 0,
+	    "a unit can be acquired again after its last release");
+
+	(void)sim_setopt("units", 1);
+}
+
+static void *
+opener(void *arg)
+{
+	struct opener *o = arg;
+	double t0;
+
+	t0 = now();
+	o->m = mixer_acquire(o->unit);
+	o->t = now() - t0;
+
+	return (NULL);
+}
@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Relative volume changes on a driver without SOUND_MIXER_STEP, where the
+ * library has to read the level, check the modify counter and write.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "mixercheck.h"
+
+#define NSTEPS		20
+#define NWRITERS	4
+#define DELAY		200			/* microseconds per ioctl */
+
+struct stepper {
+	pthread_t thr;
+	struct mixer *m;
+	int ok;					/* successful steps */
+	int eagain;				/* steps failed with EAGAIN */
+	int other;				/* steps failed otherwise */
+};
+
+static volatile int stop;
+
+static void race(struct mixer *, struct stepper *);
+static int level(struct mixer *, int);
+static void setvol(struct mixer *, int, float);
+static void *stepper(void *);
+static void *writer(void *);
+
+void
+check_step(void)
+{
+	struct stepper s[2];
+	struct mixer *m;
+	pthread_t thr[NWRITERS];
+	int i, lv;
+
+	if ((m = mixer_open("/dev/mixer0")) == NULL)
+		err(1, "mixer_open");
+	setvol(m, SOUND_MIXER_PCM, MIX_VOLMIN);
+	check(mixer_step_vol(m, mixer_get_dev(m, SOUND_MIXER_PCM), 0.01f,
+	    0.02f) == 0 && level(m, SOUND_MIXER_PCM) == (1 | 2 << 8),
+	    "a step is applied with SOUND_MIXER_STEP");
+
+	(void)sim_setopt("delay", DELAY);
+
+	/*
+	 * Two writers stepping the same device from their own handles: with
+	 * SOUND_MIXER_STEP no step is lost. Without it, nothing is locked,
+	 * so steps may be lost, but a step never fails otherwise than with
+	 * EAGAIN and the level never goes past the steps that succeeded.
+	 */
+	race(m, s);
+	lv = s[0].ok + s[1].ok;
+	check(lv == 2 * NSTEPS && level(m, SOUND_MIXER_PCM) == (lv | lv << 8),
+	    "racing steps with SOUND_MIXER_STEP are not lost");
+	(void)sim_setopt("nostep", 1);
+	race(m, s);
+	lv = s[0].ok + s[1].ok;
+	check(s[0].other == 0 && s[1].other == 0 &&
+	    (level(m, SOUND_MIXER_PCM) & 0xff) <= lv,
+	    "racing steps without it only fail with EAGAIN (%d of %d "
+	    "applied, level %d)", lv, 2 * NSTEPS,
+	    level(m, SOUND_MIXER_PCM) & 0xff);
+
+	/*
+	 * Steps against writers that keep changing another device, and so
+	 * the modify counter: a step either lands or fails with EAGAIN, and
+	 * then it must not have written anything.
+	 */
+	setvol(m, SOUND_MIXER_PCM, MIX_VOLMIN);
+	memset(&s[0], 0, sizeof(s[0]));
+	s[0].m = m;
+	stop = 0;
+	for (i = 0; i < NWRITERS; i++) {
+		if (pthread_create(&thr[i], NULL, writer, NULL) != 0)
+			errx(1, "pthread_create");
+	}
+	(void)stepper(&s[0]);
+	stop = 1;
+	for (i = 0; i < NWRITERS; i++)
+		(void)pthread_join(thr[i], NULL);
+	check(s[0].eagain > 0 && s[0].other == 0 &&
+	    level(m, SOUND_MIXER_PCM) == (s[0].ok | s[0].ok << 8),
+	    "a step that keeps losing the race fails with EAGAIN "
+	    "and writes nothing (%d applied, %d EAGAIN)", s[0].ok,
+	    s[0].eagain);
+
+	(void)sim_setopt("delay", 0);
+	(void)sim_setopt("nostep", 0);
+	(void)mixer_close(m);
+}
+
+/*
+ * Step the PCM volume from two threads with handles of their own, starting
+ * from MIX_VOLMIN.
+ */
+static void
+race(struct mixer *m, struct stepper *s)
+{
+	int i;
+
+	setvol(m, SOUND_MIXER_PCM, MIX_VOLMIN);
+	for (i = 0; i < 2; i++) {
+		memset(&s[i], 0, sizeof(s[i]));
+		if ((s[i].m = mixer_open("/dev/mixer0")) == NULL)
+			err(1, "mixer_open");
+		if (pthread_create(&s[i].thr, NULL, stepper, &s[i]) != 0)
+			errx(1, "pthread_create");
+	}
+	for (i = 0; i < 2; i++) {
+		(void)pthread_join(s[i].thr, NULL);
+		(void)mixer_close(s[i].m);
+	}
+}
+
+/*
+ * The level of a device in the driver, as left | right << 8.
+ */
+static int
+level(struct mixer *m, int devno)
+{
+	struct mix_dev *d;
+
+	if (mixer_refresh(m) < 0 || (d = mixer_get_dev(m, devno)) == NULL)
+		return (-1);
+
+	return (MIX_VOLDENORM(d->vol.left) | MIX_VOLDENORM(d->vol.right) << 8);
+}
+
+static void
+setvol(struct mixer *m, int devno, float v)
+{
+	mix_volume_t vol;
+
+	vol.left = vol.right = v;
+	if ((m->dev = mixer_get_dev(m, devno)) == NULL ||
+	    mixer_set_vol(m, vol) < 0)
+		err(1, "mixer_set_vol");
+}
+
+static void *
+stepper(void *arg)
+{
+	struct stepper *s = arg;
+	int i;
+
+	for (i = 0; i < NSTEPS; i++) {
+		if (mixer_step_vol(s->m, mixer_get_dev(s->m, SOUND_MIXER_PCM),
+		    0.01f, 0.01f) == 0)
+			s->ok++;
+		else if (errno == EAGAIN)
+			s->eagain++;
+		else
+			s->other++;
+	}
+
+	return (NULL);
+}
+
+static void *
+writer(void *arg __unused)
+{
+	struct mixer *m;
+	float v = 0;
+
+	if ((m = mixer_open("/dev/mixer0")) == NULL)
+		err(1, "mixer_open");
+	while (!stop) {
+		v = v < 0.5f ? v + 0.01f : 0;
+		setvol(m, SOUND_MIXER_VOLUME, v);
+	}
+	(void)mixer_close(m);
+
+	return (NULL);
+}
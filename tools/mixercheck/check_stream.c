@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Per-stream volume on simulated dsp devices, and the refusal of
+ * descriptors that only look like streams: the mixer of a card with a
+ * single PCM device, and a dsp device on a kernel without per-stream
+ * volume, which passes the mixer requests on to such a mixer.
+ */
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mixer.h>
+#include <unistd.h>
+
+#include "mixercheck.h"
+
+static int refused(const char *, int);
+
+void
+check_stream(void)
+{
+	struct mix_stream *ms;
+	mix_volume_t vol;
+	int fd, mask;
+
+	if ((fd = open("/dev/dsp0", O_WRONLY)) < 0)
+		err(1, "open");
+	if ((ms = mixer_stream_new(fd)) == NULL)
+		err(1, "mixer_stream_new");
+	vol.left = 0.2f;
+	vol.right = 0.4f;
+	check(mixer_stream_set_vol(ms, vol) == 0 &&
+	    mixer_stream_get_vol(ms, &vol) == 0 &&
+	    MIX_VOLDENORM(vol.left) == 20 && MIX_VOLDENORM(vol.right) == 40,
+	    "a playback stream has a volume of its own");
+	check(mixer_stream_set_mute(ms, MIX_MUTE) == 0 &&
+	    mixer_stream_get_mute(ms) == 1 &&
+	    mixer_stream_set_mute(ms, MIX_TOGGLEMUTE) == 0 &&
+	    mixer_stream_get_mute(ms) == 0, "and a mute");
+	check(mixer_stream_set_ramp(ms, 50) == 0, "and a volume ramp");
+	mixer_stream_free(ms);
+	(void)close(fd);
+
+	if ((fd = open("/dev/dsp0", O_RDONLY)) < 0)
+		err(1, "open");
+	ms = mixer_stream_new(fd);
+	check(ms != NULL && mixer_stream_set_vol(ms, vol) == 0,
+	    "a recording stream is accepted");
+	if (ms != NULL)
+		mixer_stream_free(ms);
+	(void)close(fd);
+
+	if ((fd = open("/dev/mixer0", O_RDWR)) < 0)
+		err(1, "open");
+	if (ioctl(fd, SOUND_MIXER_READ_DEVMASK, &mask) < 0)
+		err(1, "SOUND_MIXER_READ_DEVMASK");
+	(void)close(fd);
+	(void)sim_setopt("devmask", SOUND_MASK_PCM);
+	check(refused("/dev/mixer0", O_RDWR),
+	    "the mixer of a card with only a PCM device is refused");
+	(void)sim_setopt("nostream", 1);
+	check(refused("/dev/dsp0", O_WRONLY),
+	    "so is a dsp device without per-stream volume in front of it");
+	(void)sim_setopt("nostream", 0);
+	(void)sim_setopt("devmask", mask);
+}
+
+/*
+ * Return whether mixer_stream_new() refuses `path` with ENODEV.
+ */
+static int
+refused(const char *path, int flags)
+{
+	struct mix_stream *ms;
+	int fd, rc;
+
+	if ((fd = open(path, flags)) < 0)
+		err(1, "open");
+	ms = mixer_stream_new(fd);
+	rc = ms == NULL && errno == ENODEV;
+	if (ms != NULL)
+		mixer_stream_free(ms);
+	(void)close(fd);
+
+	return (rc);
+}
@@ -0,0 +1,154 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Functional checks of libmixer against libmixersim. Every check sets up
+ * what it needs on the simulated units, including slow ioctls where timing
+ * matters, and prints a line per property it verified.
+ */
+
+#include <sys/param.h>
+
+#include <dlfcn.h>
+#include <err.h>
+#include <mixer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mixercheck.h"
+
+int (*sim_setopt)(const char *, int);
+int (*sim_attach)(int);
+int (*sim_detach)(int);
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} checks[] = {
+	{ "alloc",	check_alloc },
+	{ "async",	check_async },
+	{ "coalesce",	check_coalesce },
+	{ "compat",	check_compat },
+	{ "ctl",	check_ctl },
+	{ "group",	check_group },
+	{ "meter",	check_meter },
+	{ "share",	check_share },
+	{ "step",	check_step },
+	{ "stream",	check_stream },
+};
+
+static const char *curname;
+static int nfail;
+
+static void usage(void) __dead2;
+
+int
+main(int argc, char *argv[])
+{
+	size_t i;
+	int ch, j;
+
+	while ((ch = getopt(argc, argv, "")) != -1)
+		usage();
+	argc -= optind;
+	argv += optind;
+
+	sim_setopt = (int (*)(const char *, int))dlsym(RTLD_DEFAULT,
+	    "mixersim_setopt");
+	sim_attach = (int (*)(int))dlsym(RTLD_DEFAULT, "mixersim_attach");
+	sim_detach = (int (*)(int))dlsym(RTLD_DEFAULT, "mixersim_detach");
+	if (sim_setopt == NULL || sim_attach == NULL || sim_detach == NULL)
+		errx(1, "libmixersim has to be preloaded");
+	for (j = 0; j < argc; j++) {
+		for (i = 0; i < nitems(checks); i++) {
+			if (strcmp(argv[j], checks[i].name) == 0)
+				break;
+		}
+		if (i == nitems(checks))
+			errx(1, "unknown check: %s", argv[j]);
+	}
+	for (i = 0; i < nitems(checks); i++) {
+		for (j = 0; j < argc; j++) {
+			if (strcmp(argv[j], checks[i].name) == 0)
+				break;
+		}
+		if (argc > 0 && j == argc)
+			continue;
+		curname = checks[i].name;
+		checks[i].fn();
+	}
+
+	return (nfail != 0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [check ...]\n", getprogname());
+	exit(1);
+}
+
+void
+check(int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("%s: %s: ", ok ? "ok" : "FAIL", curname);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	if (!ok)
+		nfail++;
+}
+
+/*
+ * Check the cached volume of a device, at the precision of the device.
+ */
+int
+samevol(struct mixer *m, int devno, float l, float r)
+{
+	struct mix_dev *d;
+
+	if ((d = mixer_get_dev(m, devno)) == NULL)
+		return (0);
+
+	return (MIX_VOLDENORM(d->vol.left) == MIX_VOLDENORM(l) &&
+	    MIX_VOLDENORM(d->vol.right) == MIX_VOLDENORM(r));
+}
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
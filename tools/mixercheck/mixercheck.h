@@ -0,0 +1,50 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+#ifndef _MIXERCHECK_H_
+#define _MIXERCHECK_H_
+
+struct mixer;
+
+extern int (*sim_setopt)(const char *, int);
+extern int (*sim_attach)(int);
+extern int (*sim_detach)(int);
+
+void check(int, const char *, ...) __printflike(2, 3);
+int samevol(struct mixer *, int, float, float);
+double now(void);
+
+void check_alloc(void);
+void check_async(void);
+void check_coalesce(void);
+void check_compat(void);
+void check_ctl(void);
+void check_group(void);
+void check_meter(void);
+void check_share(void);
+void check_step(void);
+void check_stream(void);
+
+#endif /* _MIXERCHECK_H_ */
@@ -0,0 +1,370 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Exercise the hotplug manager of libmixer.
+ *
+ * By default, units of libmixersim are unplugged and plugged in again behind
+ * a stub event source, and the manager is checked to reopen only those units
+ * and to restore their state, or the preset set for their card, also when
+ * the cards are identical. The time a
+ * reattach takes is then compared with reopening every unit. With -m, devd(8)
+ * events are followed instead and the units coming and going are printed.
+ */
+
+#include <sys/types.h>
+
+#include <dlfcn.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mixer.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int (*sim_attach)(int);
+static int (*sim_detach)(int);
+static int (*sim_setopt)(const char *, int);
+static int evpipe[2];
+static int nattach, ndetach, nfail;
+
+static void usage(void) __dead2;
+static int stub_getfd(void *);
+static int stub_next(void *, struct mix_hpevent *);
+static void post(struct mix_hotplug *, int, int);
+static void replug(struct mix_hotplug *, int, int);
+static void setvol(struct mix_hotplug *, int, float);
+static void samecards(int);
+static void count(struct mixer *, int, void *);
+static void show(struct mixer *, int, void *);
+static void check(int, const char *);
+static int samevol(struct mixer *, int, float, float);
+static double now(void);
+static void monitor(void);
+
+int
+main(int argc, char *argv[])
+{
+	struct mix_hpsource src = {
+		.getfd = stub_getfd,
+		.next = stub_next,
+	};
+	struct mix_preset_ent ent = {
+		.dev = "vol",
+		.flags = MIX_PRESET_VOL,
+		.vol = { 0.5f, 0.5f },
+	};
+	struct mix_hotplug *h;
+	struct mix_preset *p;
+	struct mixer *m0, *m1, **all;
+	char card[sizeof(m0->ci.longname)], buf[NAME_MAX];
+	double t0, tre, tfull;
+	int ch, i, j, n, loops = 1000, mflag = 0;
+
+	while ((ch = getopt(argc, argv, "mn:")) != -1) {
+		switch (ch) {
+		case 'm':
+			mflag = 1;
+			break;
+		case 'n':
+			if ((loops = atoi(optarg)) < 1)
+				errx(1, "invalid loop count: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (mflag)
+		monitor();
+
+	sim_attach = (int (*)(int))dlsym(RTLD_DEFAULT, "mixersim_attach");
+	sim_detach = (int (*)(int))dlsym(RTLD_DEFAULT, "mixersim_detach");
+	sim_setopt = (int (*)(const char *, int))dlsym(RTLD_DEFAULT,
+	    "mixersim_setopt");
+	if (sim_attach == NULL || sim_detach == NULL || sim_setopt == NULL)
+		errx(1, "libmixersim has to be preloaded, or use -m");
+	if ((n = mixer_get_nmixers()) < 2)
+		errx(1, "need at least 2 simulated units");
+	if (pipe(evpipe) < 0 || fcntl(evpipe[0], F_SETFL, O_NONBLOCK) < 0)
+		err(1, "pipe");
+
+	if ((h = mixer_hotplug_new(&src, count, NULL)) == NULL)
+		err(1, "mixer_hotplug_new");
+	check(nattach == n, "all units opened on start");
+	m0 = mixer_hotplug_get(h, 0);
+	m1 = mixer_hotplug_get(h, 1);
+	m1->dev = mixer_get_dev(m1, SOUND_MIXER_VOLUME);
+	if (mixer_set_vol(m1, (mix_volume_t){ 0.2f, 0.3f }) < 0 ||
+	    mixer_set_mutemask(m1, 1 << SOUND_MIXER_PCM, MIX_MUTE) < 0)
+		err(1, "cannot change unit 1");
+
+	(void)sim_detach(1);
+	post(h, MIX_HP_DETACH, 1);
+	check(mixer_hotplug_get(h, 1) == NULL && ndetach == 1,
+	    "detached unit closed");
+	(void)sim_attach(1);
+	post(h, MIX_HP_ATTACH, 1);
+	check(nattach == n + 1, "only the attached unit opened");
+	check(mixer_hotplug_get(h, 0) == m0, "other units left alone");
+	m1 = mixer_hotplug_get(h, 1);
+	check(m1 != NULL && mixer_refresh(m1) == 0 &&
+	    samevol(m1, SOUND_MIXER_VOLUME, 0.2f, 0.3f) &&
+	    MIX_ISMUTE(m1, SOUND_MIXER_PCM), "state restored");
+
+	(void)strlcpy(card, m1->ci.longname, sizeof(card));
+	if ((p = mixer_preset_compile(&ent, 1)) == NULL)
+		err(1, "mixer_preset_compile");
+	if (mixer_hotplug_set_preset(h, card, p) < 0)
+		err(1, "mixer_hotplug_set_preset");
+	(void)sim_detach(1);
+	post(h, MIX_HP_DETACH, 1);
+	(void)sim_attach(1);
+	post(h, MIX_HP_ATTACH, 1);
+	m1 = mixer_hotplug_get(h, 1);
+	check(m1 != NULL && mixer_refresh(m1) == 0 &&
+	    samevol(m1, SOUND_MIXER_VOLUME, 0.5f, 0.5f), "preset applied");
+
+	t0 = now();
+	for (i = 0; i < loops; i++) {
+		(void)sim_detach(1);
+		post(h, MIX_HP_DETACH, 1);
+		(void)sim_attach(1);
+		post(h, MIX_HP_ATTACH, 1);
+	}
+	tre = (now() - t0) / loops;
+	(void)mixer_hotplug_set_preset(h, card, NULL);
+	mixer_hotplug_free(h);
+	mixer_preset_free(p);
+	samecards(n);
+
+	if ((all = calloc(n, sizeof(struct mixer *))) == NULL)
+		err(1, "calloc");
+	t0 = now();
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < n; j++) {
+			(void)snprintf(buf, sizeof(buf), "/dev/mixer%d", j);
+			if ((all[j] = mixer_open(buf)) == NULL)
+				err(1, "mixer_open: %s", buf);
+		}
+		for (j = 0; j < n; j++)
+			(void)mixer_close(all[j]);
+	}
+	tfull = (now() - t0) / loops;
+	free(all);
+	printf("reattach one unit: %.1f us, reopen all %d units: %.1f us\n",
+	    tre * 1e6, n, tfull * 1e6);
+
+	return (nfail != 0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-n loops]\n"
+	    "       %s -m\n", getprogname(), getprogname());
+	exit(1);
+}
+
+static int
+stub_getfd(void *arg __unused)
+{
+	return (evpipe[0]);
+}
+
+static int
+stub_next(void *arg __unused, struct mix_hpevent *ev)
+{
+	ssize_t n;
+
+	if ((n = read(evpipe[0], ev, sizeof(*ev))) == sizeof(*ev))
+		return (1);
+	if (n < 0 && errno == EAGAIN)
+		return (0);
+	errno = EIO;
+
+	return (-1);
+}
+
+/*
+ * Send an event through the stub source and let the manager handle it.
+ */
+static void
+post(struct mix_hotplug *h, int type, int unit)
+{
+	struct mix_hpevent ev = { .type = type, .unit = unit };
+
+	if (write(evpipe[1], &ev, sizeof(ev)) != sizeof(ev))
+		err(1, "write");
+	if (mixer_hotplug_dispatch(h) < 0)
+		err(1, "mixer_hotplug_dispatch");
+}
+
+/*
+ * Unplug or plug in a simulated unit and tell the manager.
+ */
+static void
+replug(struct mix_hotplug *h, int type, int unit)
+{
+	if (type == MIX_HP_ATTACH)
+		(void)sim_attach(unit);
+	else
+		(void)sim_detach(unit);
+	post(h, type, unit);
+}
+
+static void
+setvol(struct mix_hotplug *h, int unit, float v)
+{
+	struct mixer *m;
+
+	if ((m = mixer_hotplug_get(h, unit)) == NULL ||
+	    (m->dev = mixer_get_dev(m, SOUND_MIXER_VOLUME)) == NULL ||
+	    mixer_set_vol(m, (mix_volume_t){ v, v }) < 0)
+		err(1, "cannot change unit %d", unit);
+}
+
+/*
+ * Cards with the same name, told apart by their device node.
+ */
+static void
+samecards(int n)
+{
+	struct mix_hpsource src = {
+		.getfd = stub_getfd,
+		.next = stub_next,
+	};
+	struct mix_hotplug *h;
+	struct mixer *m;
+	int unit, ok;
+
+	(void)sim_setopt("samecard", 1);
+	if ((h = mixer_hotplug_new(&src, NULL, NULL)) == NULL)
+		err(1, "mixer_hotplug_new");
+	for (unit = 0; unit < 2; unit++)
+		setvol(h, unit, 0.1f * (unit + 1));
+	for (unit = 0; unit < 2; unit++)
+		replug(h, MIX_HP_DETACH, unit);
+	for (unit = 0; unit < 2; unit++)
+		replug(h, MIX_HP_ATTACH, unit);
+	for (unit = 0, ok = 1; unit < 2; unit++) {
+		m = mixer_hotplug_get(h, unit);
+		ok &= m != NULL && mixer_refresh(m) == 0 &&
+		    samevol(m, SOUND_MIXER_VOLUME, 0.1f * (unit + 1),
+		    0.1f * (unit + 1));
+	}
+	check(ok, "identical cards get their own state back");
+
+	/* Unit 1 comes back as a unit that has not been seen before. */
+	setvol(h, 1, 0.4f);
+	replug(h, MIX_HP_DETACH, 1);
+	if (sim_setopt("units", n + 1) < 0)
+		err(1, "mixersim_setopt");
+	post(h, MIX_HP_ATTACH, n);
+	m = mixer_hotplug_get(h, n);
+	check(m != NULL && mixer_refresh(m) == 0 &&
+	    samevol(m, SOUND_MIXER_VOLUME, 0.4f, 0.4f),
+	    "a card under a new node gets the state of one that went away");
+	replug(h, MIX_HP_ATTACH, 1);
+	m = mixer_hotplug_get(h, 1);
+	check(m != NULL && mixer_refresh(m) == 0 &&
+	    samevol(m, SOUND_MIXER_VOLUME, 0.75f, 0.75f),
+	    "but not the state of a card that is attached");
+
+	mixer_hotplug_free(h);
+	(void)sim_setopt("units", n);
+	(void)sim_setopt("samecard", 0);
+}
+
+static void
+count(struct mixer *m __unused, int ev, void *arg __unused)
+{
+	if (ev == MIX_HP_ATTACH)
+		nattach++;
+	else
+		ndetach++;
+}
+
+static void
+show(struct mixer *m, int ev, void *arg __unused)
+{
+	printf("%s %s <%s>\n", ev == MIX_HP_ATTACH ? "attach" : "detach",
+	    m->mi.name, m->ci.longname);
+	(void)fflush(stdout);
+}
+
+static void
+check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if (!ok)
+		nfail++;
+}
+
+static int
+samevol(struct mixer *m, int devno, float l, float r)
+{
+	struct mix_dev *d;
+
+	if ((d = mixer_get_dev(m, devno)) == NULL)
+		return (0);
+
+	return (MIX_VOLDENORM(d->vol.left) == MIX_VOLDENORM(l) &&
+	    MIX_VOLDENORM(d->vol.right) == MIX_VOLDENORM(r));
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void __dead2
+monitor(void)
+{
+	struct mix_hotplug *h;
+	struct pollfd pfd;
+
+	if ((h = mixer_hotplug_new(NULL, show, NULL)) == NULL)
+		err(1, "mixer_hotplug_new");
+	pfd.fd = mixer_hotplug_getfd(h);
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+		if (mixer_hotplug_dispatch(h) < 0)
+			err(1, "mixer_hotplug_dispatch");
+	}
+}
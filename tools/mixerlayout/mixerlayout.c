@@ -0,0 +1,286 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Compare the memory and the walking speed of mixer handles in the current
+ * layout of struct mix_dev and mix_ctl with the layout they had before, in
+ * which every device and control carried a char[NAME_MAX] name and was
+ * allocated on its own. The old layout is rebuilt here from a real handle,
+ * with the same devices and controls.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <err.h>
+#include <limits.h>
+#include <mixer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct old_dev;
+
+struct old_ctl {
+	struct old_dev *parent_dev;
+	int id;
+	char name[NAME_MAX];
+	int (*mod)(struct mix_dev *, void *);
+	int (*print)(struct mix_dev *, void *);
+	TAILQ_ENTRY(old_ctl) ctls;
+};
+
+struct old_dev {
+	struct mixer *parent_mixer;
+	char name[NAME_MAX];
+	int devno;
+	mix_volume_t vol;
+	int nctl;
+	TAILQ_HEAD(, old_ctl) ctls;
+	TAILQ_ENTRY(old_dev) devs;
+};
+
+static TAILQ_HEAD(, old_dev) olddevs = TAILQ_HEAD_INITIALIZER(olddevs);
+
+static const char *ctlnames[] = { "volume", "mute", "recsrc" };
+
+static void usage(void) __dead2;
+static void build(struct mixer *, int);
+static double walk_old(int);
+static double walk_new(struct mixer *, int);
+static double walk_acc(struct mixer *, int);
+static double now(void);
+
+static volatile float sink;
+
+int
+main(int argc, char *argv[])
+{
+	struct mixer *m;
+	const char *name = NULL;
+	size_t oldsz, newsz, names;
+	double told, tnew, tacc;
+	int ch, i, nctl = 3, loops = 100000, visits;
+
+	while ((ch = getopt(argc, argv, "c:d:n:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if ((nctl = atoi(optarg)) < 0)
+				errx(1, "invalid control count: %s", optarg);
+			break;
+		case 'd':
+			name = optarg;
+			break;
+		case 'n':
+			if ((loops = atoi(optarg)) < 1)
+				errx(1, "invalid loop count: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((m = mixer_open(name)) == NULL)
+		err(1, "mixer_open");
+	build(m, nctl);
+
+	/* Interned names are one allocation per distinct name. */
+	for (i = 0, names = 0; i < nctl; i++) {
+		names += sizeof(void *) + (i < (int)nitems(ctlnames) ?
+		    strlen(ctlnames[i]) : strlen("ctl00")) + 1;
+	}
+	oldsz = sizeof(struct mixer) + m->ndev * (sizeof(struct old_dev) +
+	    nctl * sizeof(struct old_ctl));
+	newsz = sizeof(struct mixer) + m->ndev * (sizeof(struct mix_dev) +
+	    nctl * sizeof(mix_ctl_t)) + names;
+
+	told = walk_old(loops);
+	tnew = walk_new(m, loops);
+	tacc = walk_acc(m, loops);
+	visits = loops * m->ndev;
+	printf("%d devices, %d controls each; sizes in bytes, "
+	    "walk in ns per device\n", m->ndev, nctl);
+	printf("%-10s %6s %6s %8s %10s %8s\n", "layout", "dev", "ctl",
+	    "devs+ctl", "handle", "walk");
+	printf("%-10s %6zu %6zu %8zu %10zu %8.1f\n", "old",
+	    sizeof(struct old_dev), sizeof(struct old_ctl),
+	    oldsz - sizeof(struct mixer), oldsz, told * 1e9 / visits);
+	printf("%-10s %6zu %6zu %8zu %10zu %8.1f\n", "new",
+	    sizeof(struct mix_dev), sizeof(mix_ctl_t),
+	    newsz - sizeof(struct mixer), newsz, tnew * 1e9 / visits);
+	printf("%-10s %6s %6s %8s %10s %8.1f\n", "accessors", "", "", "", "",
+	    tacc * 1e9 / visits);
+	(void)mixer_close(m);
+
+	return (0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-c controls] [-d device] [-n loops]\n",
+	    getprogname());
+	exit(1);
+}
+
+/*
+ * Add `nctl` controls to every device of `m`, and rebuild the devices and
+ * controls in the old layout, allocated the way the library used to.
+ */
+static void
+build(struct mixer *m, int nctl)
+{
+	struct mix_dev *dp;
+	struct old_dev *od;
+	struct old_ctl *oc;
+	mix_ctl_t *cp;
+	char buf[16];
+	int i;
+
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		for (i = 0; i < nctl; i++) {
+			if (i < (int)nitems(ctlnames))
+				(void)strlcpy(buf, ctlnames[i], sizeof(buf));
+			else
+				(void)snprintf(buf, sizeof(buf), "ctl%02d", i);
+			if (mixer_add_ctl(dp, i, buf, NULL, NULL) < 0)
+				err(1, "mixer_add_ctl");
+		}
+	}
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		if ((od = calloc(1, sizeof(struct old_dev))) == NULL)
+			err(1, "calloc");
+		od->parent_mixer = m;
+		(void)strlcpy(od->name, dp->name, sizeof(od->name));
+		od->devno = dp->devno;
+		od->vol = dp->vol;
+		TAILQ_INIT(&od->ctls);
+		TAILQ_INSERT_TAIL(&olddevs, od, devs);
+	}
+	od = TAILQ_FIRST(&olddevs);
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		TAILQ_FOREACH(cp, &dp->ctls, ctls) {
+			if ((oc = calloc(1, sizeof(struct old_ctl))) == NULL)
+				err(1, "calloc");
+			oc->parent_dev = od;
+			oc->id = cp->id;
+			(void)strlcpy(oc->name, cp->name, sizeof(oc->name));
+			TAILQ_INSERT_TAIL(&od->ctls, oc, ctls);
+			od->nctl++;
+		}
+		od = TAILQ_NEXT(od, devs);
+	}
+}
+
+/*
+ * What mixer(8) does for every device it prints: look up a control by name
+ * and read the volume.
+ */
+static double
+walk_old(int loops)
+{
+	struct old_dev *od;
+	struct old_ctl *oc;
+	double t;
+	float sum = 0;
+	int i;
+
+	t = now();
+	for (i = 0; i < loops; i++) {
+		TAILQ_FOREACH(od, &olddevs, devs) {
+			TAILQ_FOREACH(oc, &od->ctls, ctls) {
+				if (strcmp(oc->name, "recsrc") == 0)
+					break;
+			}
+			sum += od->vol.left + (oc != NULL ? oc->id : 0);
+		}
+	}
+	sink = sum;
+
+	return (now() - t);
+}
+
+static double
+walk_new(struct mixer *m, int loops)
+{
+	struct mix_dev *dp;
+	mix_ctl_t *cp;
+	double t;
+	float sum = 0;
+	int i;
+
+	t = now();
+	for (i = 0; i < loops; i++) {
+		TAILQ_FOREACH(dp, &m->devs, devs) {
+			TAILQ_FOREACH(cp, &dp->ctls, ctls) {
+				if (strcmp(cp->name, "recsrc") == 0)
+					break;
+			}
+			sum += dp->vol.left + (cp != NULL ? cp->id : 0);
+		}
+	}
+	sink = sum;
+
+	return (now() - t);
+}
+
+static double
+walk_acc(struct mixer *m, int loops)
+{
+	struct mix_dev *dp;
+	mix_ctl_t *cp;
+	double t;
+	float sum = 0;
+	int i;
+
+	t = now();
+	for (i = 0; i < loops; i++) {
+		for (dp = mixer_dev_next(m, NULL); dp != NULL;
+		    dp = mixer_dev_next(m, dp)) {
+			for (cp = mixer_ctl_next(dp, NULL); cp != NULL;
+			    cp = mixer_ctl_next(dp, cp)) {
+				if (strcmp(mixer_ctl_name(cp), "recsrc") == 0)
+					break;
+			}
+			sum += mixer_dev_vol(dp).left +
+			    (cp != NULL ? mixer_ctl_id(cp) : 0);
+		}
+	}
+	sink = sum;
+
+	return (now() - t);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
@@ -0,0 +1,478 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Play back a trace recorded with libmixertrace.so and report how long each
+ * kind of call took and how many system calls it needed. Run it under
+ * LD_PRELOAD=libmixersim.so to replay against a simulated device.
+ */
+
+#include <sys/types.h>
+
+#include <dlfcn.h>
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXHANDLES	256
+
+enum {
+	OP_OPEN = 0,
+	OP_CLOSE,
+	OP_SETVOL,
+	OP_STEPVOL,
+	OP_SETMUTE,
+	OP_MODRECSRC,
+	OP_MUTEMASK,
+	OP_RECSRCMASK,
+	OP_GETDUNIT,
+	OP_SETDUNIT,
+	OP_GETMODE,
+	OP_NMIXERS,
+	OP_SUBMIT,
+	OP_MAX,
+};
+
+struct rec {
+	long long usec;				/* time since the first call */
+	int op;					/* OP_* */
+	int h;					/* handle, -1 if none */
+	int i1;					/* opt, mask, unit or op type */
+	int i2;					/* opt */
+	float f1;				/* left volume */
+	float f2;				/* right volume */
+	char s[NAME_MAX + 1];			/* device or mixer name */
+};
+
+static struct opstat {
+	const char *name;
+	unsigned long count;
+	unsigned long errs;
+	unsigned long nioctl;
+	unsigned long nsysctl;
+	double *lat;				/* latencies in usec */
+	size_t nlat;
+	size_t maxlat;
+} stats[OP_MAX] = {
+	[OP_OPEN] =		{ .name = "open" },
+	[OP_CLOSE] =		{ .name = "close" },
+	[OP_SETVOL] =		{ .name = "setvol" },
+	[OP_STEPVOL] =		{ .name = "stepvol" },
+	[OP_SETMUTE] =		{ .name = "setmute" },
+	[OP_MODRECSRC] =	{ .name = "modrecsrc" },
+	[OP_MUTEMASK] =		{ .name = "mutemask" },
+	[OP_RECSRCMASK] =	{ .name = "recsrcmask" },
+	[OP_GETDUNIT] =		{ .name = "getdunit" },
+	[OP_SETDUNIT] =		{ .name = "setdunit" },
+	[OP_GETMODE] =		{ .name = "getmode" },
+	[OP_NMIXERS] =		{ .name = "nmixers" },
+	[OP_SUBMIT] =		{ .name = "submit" },
+};
+
+static struct mixer *handles[MAXHANDLES];
+static const char *devpath;
+
+/* Counted by the wrappers below; the async worker calls them too. */
+static atomic_ulong nioctl;
+static atomic_ulong nsysctl;
+
+static void usage(void) __dead2;
+static struct rec *load(const char *, size_t *);
+static int parse(char *, struct rec *);
+static int run(struct rec *);
+static void addlat(struct opstat *, double);
+static int cmpdbl(const void *, const void *);
+static void report(double);
+
+int
+ioctl(int fd, unsigned long req, ...)
+{
+	static int (*real_ioctl)(int, unsigned long, ...);
+	va_list ap;
+	void *arg;
+
+	if (real_ioctl == NULL)
+		real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	atomic_fetch_add(&nioctl, 1);
+
+	return (real_ioctl(fd, req, arg));
+}
+
+int
+sysctlbyname(const char *name, void *old, size_t *oldlen, const void *new,
+    size_t newlen)
+{
+	static int (*real_sysctlbyname)(const char *, void *, size_t *,
+	    const void *, size_t);
+
+	if (real_sysctlbyname == NULL &&
+	    (real_sysctlbyname = dlsym(RTLD_NEXT, "sysctlbyname")) == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+	atomic_fetch_add(&nsysctl, 1);
+
+	return (real_sysctlbyname(name, old, oldlen, new, newlen));
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec t0, t1, t2, start;
+	struct rec *recs, *r;
+	struct opstat *st;
+	size_t i, nrecs;
+	double speed = 1.0, lat, elapsed;
+	long long due, now;
+	unsigned long io, sc;
+	int ch, n, loops = 1, rc;
+
+	while ((ch = getopt(argc, argv, "d:n:s:")) != -1) {
+		switch (ch) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 'n':
+			if ((loops = atoi(optarg)) < 1)
+				errx(1, "invalid loop count: %s", optarg);
+			break;
+		case 's':
+			speed = strtod(optarg, NULL);
+			if (speed < 0)
+				errx(1, "invalid speed: %s", optarg);
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+
+	if ((recs = load(argv[0], &nrecs)) == NULL)
+		err(1, "%s", argv[0]);
+	if (nrecs == 0)
+		errx(1, "%s: empty trace", argv[0]);
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (n = 0; n < loops; n++) {
+		(void)clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nrecs; i++) {
+			r = &recs[i];
+			/* Keep the recorded pace, scaled by `speed`. */
+			if (speed > 0) {
+				due = (r->usec - recs[0].usec) / speed;
+				(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+				now = (t1.tv_sec - start.tv_sec) * 1000000LL +
+				    (t1.tv_nsec - start.tv_nsec) / 1000;
+				if (due > now) {
+					t2.tv_sec = (due - now) / 1000000;
+					t2.tv_nsec = (due - now) % 1000000 *
+					    1000;
+					(void)nanosleep(&t2, NULL);
+				}
+			}
+			st = &stats[r->op];
+			io = atomic_load(&nioctl);
+			sc = atomic_load(&nsysctl);
+			(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+			rc = run(r);
+			(void)clock_gettime(CLOCK_MONOTONIC, &t2);
+			lat = (t2.tv_sec - t1.tv_sec) * 1e6 +
+			    (t2.tv_nsec - t1.tv_nsec) / 1e3;
+			st->count++;
+			if (rc < 0)
+				st->errs++;
+			st->nioctl += atomic_load(&nioctl) - io;
+			st->nsysctl += atomic_load(&nsysctl) - sc;
+			addlat(st, lat);
+		}
+		for (i = 0; i < MAXHANDLES; i++) {
+			if (handles[i] != NULL) {
+				(void)mixer_close(handles[i]);
+				handles[i] = NULL;
+			}
+		}
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	report(elapsed);
+	free(recs);
+
+	return (0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-d device] [-n loops] [-s speed] trace\n",
+	    getprogname());
+	exit(1);
+}
+
+/*
+ * Read the whole trace, so that parsing does not get in the way of the
+ * replay.
+ */
+static struct rec *
+load(const char *path, size_t *nrecs)
+{
+	FILE *fp;
+	struct rec *recs = NULL, *p;
+	size_t n = 0, max = 0, line = 0;
+	char buf[BUFSIZ];
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (NULL);
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		line++;
+		if (n == max) {
+			max = max == 0 ? 1024 : max * 2;
+			if ((p = realloc(recs, max * sizeof(*recs))) == NULL)
+				err(1, "realloc");
+			recs = p;
+		}
+		if (parse(buf, &recs[n]) < 0) {
+			warnx("%s:%zu: ignoring malformed record", path, line);
+			continue;
+		}
+		n++;
+	}
+	(void)fclose(fp);
+	*nrecs = n;
+
+	return (recs);
+}
+
+static int
+parse(char *buf, struct rec *r)
+{
+	char op[16], h[16];
+	int i, n, rc;
+
+	memset(r, 0, sizeof(*r));
+	if (sscanf(buf, "%lld %15s %15s %d %n", &r->usec, op, h, &rc, &n) < 4)
+		return (-1);
+	buf += n;
+	for (i = 0; i < OP_MAX; i++) {
+		if (strcmp(op, stats[i].name) == 0)
+			break;
+	}
+	if (i == OP_MAX)
+		return (-1);
+	r->op = i;
+	r->h = -1;
+	if (strcmp(h, "-") != 0 &&
+	    ((r->h = atoi(h)) < 0 || r->h >= MAXHANDLES))
+		return (-1);
+
+	switch (r->op) {
+	case OP_OPEN:
+		n = sscanf(buf, "%255s", r->s) == 1 ? 0 : -1;
+		break;
+	case OP_SETVOL:
+	case OP_STEPVOL:
+		n = sscanf(buf, "%255s %f %f", r->s, &r->f1, &r->f2) == 3 ?
+		    0 : -1;
+		break;
+	case OP_SETMUTE:
+	case OP_MODRECSRC:
+		n = sscanf(buf, "%255s %i", r->s, &r->i1) == 2 ? 0 : -1;
+		break;
+	case OP_MUTEMASK:
+	case OP_RECSRCMASK:
+		n = sscanf(buf, "%i %i", &r->i1, &r->i2) == 2 ? 0 : -1;
+		break;
+	case OP_SETDUNIT:
+	case OP_GETMODE:
+		n = sscanf(buf, "%d", &r->i1) == 1 ? 0 : -1;
+		break;
+	case OP_SUBMIT:
+		n = sscanf(buf, "%255s %d %i %f %f", r->s, &r->i1, &r->i2,
+		    &r->f1, &r->f2) == 5 ? 0 : -1;
+		break;
+	default:
+		n = 0;
+		break;
+	}
+	/* Everything but these works on an open mixer. */
+	if (r->h < 0 && r->op != OP_GETDUNIT && r->op != OP_GETMODE &&
+	    r->op != OP_NMIXERS)
+		return (-1);
+
+	return (n);
+}
+
+/*
+ * Perform a single call, the same way the recorded program did.
+ */
+static int
+run(struct rec *r)
+{
+	struct pollfd pfd;
+	struct mixer *m = NULL;
+	struct mix_dev *dp = NULL;
+	mix_volume_t v;
+	mix_op_t op, *done;
+
+	if (r->h >= 0) {
+		m = handles[r->h];
+		if (r->op == OP_OPEN) {
+			if (m != NULL)
+				(void)mixer_close(m);
+			handles[r->h] = mixer_open(devpath != NULL ? devpath :
+			    strcmp(r->s, "-") == 0 ? NULL : r->s);
+			return (handles[r->h] == NULL ? -1 : 0);
+		}
+		if (m == NULL)
+			return (-1);
+	}
+	switch (r->op) {
+	case OP_SETVOL:
+	case OP_STEPVOL:
+	case OP_SETMUTE:
+	case OP_MODRECSRC:
+	case OP_SUBMIT:
+		if ((dp = mixer_get_dev_byname(m, r->s)) == NULL)
+			return (-1);
+		m->dev = dp;
+		break;
+	}
+
+	switch (r->op) {
+	case OP_CLOSE:
+		handles[r->h] = NULL;
+		return (mixer_close(m));
+	case OP_SETVOL:
+		v.left = r->f1;
+		v.right = r->f2;
+		return (mixer_set_vol(m, v));
+	case OP_STEPVOL:
+		return (mixer_step_vol(m, dp, r->f1, r->f2));
+	case OP_SETMUTE:
+		return (mixer_set_mute(m, r->i1));
+	case OP_MODRECSRC:
+		return (mixer_mod_recsrc(m, r->i1));
+	case OP_MUTEMASK:
+		return (mixer_set_mutemask(m, r->i1, r->i2));
+	case OP_RECSRCMASK:
+		return (mixer_set_recsrcmask(m, r->i1, r->i2));
+	case OP_GETDUNIT:
+		return (mixer_get_dunit());
+	case OP_SETDUNIT:
+		return (mixer_set_dunit(m, r->i1));
+	case OP_GETMODE:
+		return (mixer_get_mode(r->i1));
+	case OP_NMIXERS:
+		return (mixer_get_nmixers());
+	case OP_SUBMIT:
+		/* Wait for the completion, the latency is the round trip. */
+		memset(&op, 0, sizeof(op));
+		op.type = r->i1;
+		op.devno = dp->devno;
+		op.opt = r->i2;
+		op.vol.left = r->f1;
+		op.vol.right = r->f2;
+		if (mixer_submit(m, &op) < 0)
+			return (-1);
+		pfd.fd = mixer_get_compfd(m);
+		pfd.events = POLLIN;
+		for (;;) {
+			while ((done = mixer_complete(m)) != NULL) {
+				if (done == &op)
+					return (op.error != 0 ? -1 : 0);
+			}
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				return (-1);
+		}
+	}
+
+	return (-1);
+}
+
+static void
+addlat(struct opstat *st, double lat)
+{
+	double *p;
+
+	if (st->nlat == st->maxlat) {
+		st->maxlat = st->maxlat == 0 ? 256 : st->maxlat * 2;
+		if ((p = realloc(st->lat, st->maxlat * sizeof(double))) == NULL)
+			err(1, "realloc");
+		st->lat = p;
+	}
+	st->lat[st->nlat++] = lat;
+}
+
+static int
+cmpdbl(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+#define PCTL(st, q)	((st)->lat[(size_t)((q) * ((st)->nlat - 1))])
+
+static void
+report(double elapsed)
+{
+	struct opstat *st;
+	unsigned long total = 0, errs = 0;
+	int i;
+
+	printf("%-10s %8s %6s %8s %8s %9s %9s %9s %9s\n", "op", "count",
+	    "errs", "ioctl/op", "sctl/op", "p50(us)", "p90(us)", "p99(us)",
+	    "max(us)");
+	for (i = 0; i < OP_MAX; i++) {
+		st = &stats[i];
+		if (st->count == 0)
+			continue;
+		qsort(st->lat, st->nlat, sizeof(double), cmpdbl);
+		printf("%-10s %8lu %6lu %8.2f %8.2f %9.1f %9.1f %9.1f %9.1f\n",
+		    st->name, st->count, st->errs,
+		    (double)st->nioctl / st->count,
+		    (double)st->nsysctl / st->count,
+		    PCTL(st, 0.50), PCTL(st, 0.90), PCTL(st, 0.99),
+		    st->lat[st->nlat - 1]);
+		total += st->count;
+		errs += st->errs;
+		free(st->lat);
+	}
+	printf("%lu calls, %lu errors in %.3f s, %.0f calls/s\n", total, errs,
+	    elapsed, elapsed > 0 ? total / elapsed : 0);
+}
@@ -0,0 +1,649 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * In-memory simulation of the sound(4) mixer, meant to be loaded with
+ * LD_PRELOAD. Opening /dev/mixerN for a simulated unit returns a descriptor
+ * to /dev/null, and ioctls on such descriptors are served from a table
+ * instead of a driver. Everything else is passed on to the C library.
+ *
+ * /dev/dspN descriptors are simulated too, but only as far as the stream
+ * volume and mute go; they cannot play or record.
+ *
+ * The state lives in a shared anonymous mapping set up when the object is
+ * loaded, so that it is shared by all threads and by the children of the
+ * process, like the state of a real device is.
+ *
+ * Tests can detach and attach units at run time with mixersim_detach() and
+ * mixersim_attach(), looked up with dlsym(3). A detached unit cannot be
+ * opened, descriptors opened before fail with ENXIO, and it comes back with
+ * the default state, like a card that has been unplugged and plugged in
+ * again. The knobs below can also be changed at run time with
+ * mixersim_setopt(), e.g. mixersim_setopt("delay", 1000).
+ *
+ * Environment:
+ *	MIXERSIM_UNITS	number of simulated units (default 1)
+ *	MIXERSIM_DELAY	microseconds every ioctl takes (default 0)
+ *	MIXERSIM_NOSTATE	if set, behave like a driver without
+ *			SOUND_MIXER_READ_STATE
+ *	MIXERSIM_NOSTEP	if set, behave like a driver without
+ *			SOUND_MIXER_STEP
+ *	MIXERSIM_NOWRITE	if set, fail every mixer write with EIO
+ *	MIXERSIM_DEVMASK	devices of the simulated mixers, as a mask
+ *			(default: vol, bass, treble, pcm, speaker, line,
+ *			mic, cd, rec)
+ *	MIXERSIM_NOSTREAM	if set, behave like a kernel without per-stream
+ *			volume, which passes mixer requests on dsp devices
+ *			on to the card's mixer
+ *	MIXERSIM_BUSY	units whose open fails with EBUSY, as a mask
+ *	MIXERSIM_SAMECARD	if set, give all units the same card name, like
+ *			identical cards have
+ *
+ * The number of units can be changed at run time with
+ * mixersim_setopt("units", n); units that are added come attached and
+ * with the default state.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/soundcard.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mixer.h>
+
+#define SIM_MAXUNITS	8
+#define SIM_MAXFD	1024
+#define BASEPATH	"/dev/mixer"
+#define DSPPATH		"/dev/dsp"
+#define SIM_DEADFD	INT_MIN			/* unit detached since open */
+
+#define SIM_DEVMASK	((1 << SOUND_MIXER_VOLUME) | (1 << SOUND_MIXER_BASS) | \
+			(1 << SOUND_MIXER_TREBLE) | (1 << SOUND_MIXER_PCM) | \
+			(1 << SOUND_MIXER_SPEAKER) | (1 << SOUND_MIXER_LINE) | \
+			(1 << SOUND_MIXER_MIC) | (1 << SOUND_MIXER_CD) | \
+			(1 << SOUND_MIXER_RECLEV))
+#define SIM_RECMASK	((1 << SOUND_MIXER_LINE) | (1 << SOUND_MIXER_MIC) | \
+			(1 << SOUND_MIXER_CD))
+
+struct sim_unit {
+	int level[SOUND_MIXER_NRDEVICES];
+	int devmask;
+	int recmask;
+	int recsrc;
+	int mutemask;
+	int counter;
+};
+
+/* Per-descriptor state of a dsp stream. */
+struct sim_stream {
+	int level;
+	int mute;
+	int ramp;
+	int rec;				/* opened read-only */
+};
+
+static struct sim_state {
+	pthread_mutex_t mtx;
+	int nunits;
+	int attached;				/* mask of attached units */
+	int dunit;
+	int delay;
+	int nostate;
+	int nostep;
+	int nowrite;
+	int devmask;
+	int nostream;
+	int busy;				/* units that fail to open */
+	int samecard;
+	struct sim_unit units[SIM_MAXUNITS];
+} *sim;
+
+/*
+ * Descriptor to unit + 1 for mixers, -(unit + 1) for dsp devices, 0 for
+ * descriptors that are not ours.
+ */
+static int sim_fds[SIM_MAXFD];
+static struct sim_stream sim_streams[SIM_MAXFD];
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_sysctlbyname)(const char *, void *, size_t *, const void *,
+    size_t);
+
+static void sim_reset(struct sim_unit *);
+static int sim_unit(const char *, const char *);
+static int sim_mixer(struct sim_unit *, int, unsigned long, void *);
+static int sim_dsp(struct sim_stream *, unsigned long, void *);
+static void sim_init(void) __attribute__((constructor));
+int mixersim_attach(int);
+int mixersim_detach(int);
+int mixersim_setopt(const char *, int);
+
+static void
+sim_init(void)
+{
+	pthread_mutexattr_t attr;
+	const char *s;
+	int i;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_sysctlbyname = dlsym(RTLD_NEXT, "sysctlbyname");
+
+	sim = mmap(NULL, sizeof(struct sim_state), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANON, -1, 0);
+	if (sim == MAP_FAILED)
+		abort();
+	(void)pthread_mutexattr_init(&attr);
+	(void)pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	(void)pthread_mutex_init(&sim->mtx, &attr);
+	(void)pthread_mutexattr_destroy(&attr);
+
+	sim->nunits = 1;
+	if ((s = getenv("MIXERSIM_UNITS")) != NULL)
+		sim->nunits = atoi(s);
+	if (sim->nunits < 1 || sim->nunits > SIM_MAXUNITS)
+		sim->nunits = 1;
+	if ((s = getenv("MIXERSIM_DELAY")) != NULL)
+		sim->delay = atoi(s);
+	sim->nostate = getenv("MIXERSIM_NOSTATE") != NULL;
+	sim->nostep = getenv("MIXERSIM_NOSTEP") != NULL;
+	sim->nowrite = getenv("MIXERSIM_NOWRITE") != NULL;
+	sim->devmask = SIM_DEVMASK;
+	if ((s = getenv("MIXERSIM_DEVMASK")) != NULL)
+		sim->devmask = strtol(s, NULL, 0);
+	sim->nostream = getenv("MIXERSIM_NOSTREAM") != NULL;
+	if ((s = getenv("MIXERSIM_BUSY")) != NULL)
+		sim->busy = strtol(s, NULL, 0);
+	sim->samecard = getenv("MIXERSIM_SAMECARD") != NULL;
+	sim->dunit = 0;
+	for (i = 0; i < sim->nunits; i++)
+		sim_reset(&sim->units[i]);
+	sim->attached = (1 << sim->nunits) - 1;
+}
+
+static void
+sim_reset(struct sim_unit *u)
+{
+	int i;
+
+	memset(u, 0, sizeof(*u));
+	u->devmask = sim->devmask;
+	u->recmask = SIM_RECMASK;
+	u->recsrc = 1 << SOUND_MIXER_MIC;
+	for (i = 0; i < SOUND_MIXER_NRDEVICES; i++)
+		u->level[i] = 75 | 75 << 8;
+}
+
+/*
+ * Plug simulated unit `unit` back in, with the default state.
+ */
+int
+mixersim_attach(int unit)
+{
+	if (unit < 0 || unit >= sim->nunits) {
+		errno = EINVAL;
+		return (-1);
+	}
+	(void)pthread_mutex_lock(&sim->mtx);
+	if (!MIX_ISSET(unit, sim->attached)) {
+		sim_reset(&sim->units[unit]);
+		sim->attached |= 1 << unit;
+	}
+	(void)pthread_mutex_unlock(&sim->mtx);
+
+	return (0);
+}
+
+/*
+ * Unplug simulated unit `unit`. Descriptors this process has open on it stop
+ * working.
+ */
+int
+mixersim_detach(int unit)
+{
+	int fd;
+
+	if (unit < 0 || unit >= sim->nunits) {
+		errno = EINVAL;
+		return (-1);
+	}
+	(void)pthread_mutex_lock(&sim->mtx);
+	sim->attached &= ~(1 << unit);
+	for (fd = 0; fd < SIM_MAXFD; fd++) {
+		if (sim_fds[fd] == unit + 1 || sim_fds[fd] == -(unit + 1))
+			sim_fds[fd] = SIM_DEADFD;
+	}
+	(void)pthread_mutex_unlock(&sim->mtx);
+
+	return (0);
+}
+
+/*
+ * Change the knob `name`, the name of its environment variable without the
+ * MIXERSIM_ prefix, in lower case.
+ */
+int
+mixersim_setopt(const char *name, int value)
+{
+	int i;
+
+	if (strcmp(name, "delay") == 0)
+		sim->delay = value;
+	else if (strcmp(name, "nostate") == 0)
+		sim->nostate = value;
+	else if (strcmp(name, "nostep") == 0)
+		sim->nostep = value;
+	else if (strcmp(name, "nowrite") == 0)
+		sim->nowrite = value;
+	else if (strcmp(name, "devmask") == 0) {
+		(void)pthread_mutex_lock(&sim->mtx);
+		sim->devmask = value;
+		for (i = 0; i < sim->nunits; i++)
+			sim->units[i].devmask = value;
+		(void)pthread_mutex_unlock(&sim->mtx);
+	} else if (strcmp(name, "nostream") == 0)
+		sim->nostream = value;
+	else if (strcmp(name, "busy") == 0)
+		sim->busy = value;
+	else if (strcmp(name, "samecard") == 0)
+		sim->samecard = value;
+	else if (strcmp(name, "units") == 0) {
+		if (value < 1 || value > SIM_MAXUNITS) {
+			errno = EINVAL;
+			return (-1);
+		}
+		(void)pthread_mutex_lock(&sim->mtx);
+		for (i = sim->nunits; i < value; i++)
+			sim_reset(&sim->units[i]);
+		sim->attached = (sim->attached | ~((1 << sim->nunits) - 1)) &
+		    ((1 << value) - 1);
+		sim->nunits = value;
+		(void)pthread_mutex_unlock(&sim->mtx);
+	} else {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Map a device path starting with `base` to a simulated unit, or return -1.
+ */
+static int
+sim_unit(const char *path, const char *base)
+{
+	char *endp;
+	long unit;
+
+	if (strncmp(path, base, strlen(base)) != 0)
+		return (-1);
+	path += strlen(base);
+	if (*path == '\0')
+		return (sim->dunit);
+	unit = strtol(path, &endp, 10);
+	if (*endp != '\0' || unit < 0 || unit >= sim->nunits ||
+	    !MIX_ISSET(unit, sim->attached))
+		return (-1);
+
+	return (unit);
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int fd, mode = 0, unit, dsp = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if ((unit = sim_unit(path, BASEPATH)) < 0 &&
+	    (unit = sim_unit(path, DSPPATH)) >= 0)
+		dsp = 1;
+	if (unit < 0)
+		return (real_open(path, flags, mode));
+	if (MIX_ISSET(unit, sim->busy)) {
+		errno = EBUSY;
+		return (-1);
+	}
+	if ((fd = real_open("/dev/null", O_RDWR)) < 0)
+		return (-1);
+	if (fd >= SIM_MAXFD) {
+		(void)real_close(fd);
+		errno = EMFILE;
+		return (-1);
+	}
+	if (dsp) {
+		sim_streams[fd].level = 75 | 75 << 8;
+		sim_streams[fd].mute = 0;
+		sim_streams[fd].ramp = 0;
+		sim_streams[fd].rec = (flags & O_ACCMODE) == O_RDONLY;
+		sim_fds[fd] = -(unit + 1);
+	} else {
+		sim_fds[fd] = unit + 1;
+	}
+
+	return (fd);
+}
+
+int
+close(int fd)
+{
+	if (fd >= 0 && fd < SIM_MAXFD)
+		sim_fds[fd] = 0;
+
+	return (real_close(fd));
+}
+
+int
+ioctl(int fd, unsigned long req, ...)
+{
+	va_list ap;
+	void *arg;
+	int rc;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	if (fd < 0 || fd >= SIM_MAXFD || sim_fds[fd] == 0)
+		return (real_ioctl(fd, req, arg));
+
+	if (sim->delay > 0)
+		(void)usleep(sim->delay);
+	(void)pthread_mutex_lock(&sim->mtx);
+	if (sim_fds[fd] == SIM_DEADFD) {
+		errno = ENXIO;
+		rc = -1;
+	} else if (sim_fds[fd] < 0 && sim->nostream)
+		rc = sim_mixer(&sim->units[-sim_fds[fd] - 1],
+		    -sim_fds[fd] - 1, req, arg);
+	else if (sim_fds[fd] < 0)
+		rc = sim_dsp(&sim_streams[fd], req, arg);
+	else
+		rc = sim_mixer(&sim->units[sim_fds[fd] - 1], sim_fds[fd] - 1,
+		    req, arg);
+	(void)pthread_mutex_unlock(&sim->mtx);
+
+	return (rc);
+}
+
+/*
+ * Serve a mixer request, following what the patched driver does.
+ */
+static int
+sim_mixer(struct sim_unit *u, int unit, unsigned long req, void *arg)
+{
+	oss_mixerinfo *mi;
+	oss_card_info *ci;
+	oss_sysinfo *si;
+	struct snd_mixer_state *st;
+	int dev, l, r, v;
+
+	switch (req) {
+	case SNDCTL_MIXERINFO:
+		mi = arg;
+		/* Like the driver, describe any unit, by `dev`. */
+		if (mi->dev >= 0 && mi->dev != unit) {
+			if (mi->dev >= sim->nunits ||
+			    !MIX_ISSET(mi->dev, sim->attached)) {
+				errno = EINVAL;
+				return (-1);
+			}
+			unit = mi->dev;
+			u = &sim->units[unit];
+		}
+		memset(mi, 0, sizeof(*mi));
+		mi->dev = unit;
+		mi->card_number = unit;
+		mi->modify_counter = u->counter;
+		mi->enabled = 1;
+		(void)snprintf(mi->name, sizeof(mi->name), "pcm%d:mixer", unit);
+		(void)snprintf(mi->id, sizeof(mi->id), "pcm%d", unit);
+		(void)snprintf(mi->devnode, sizeof(mi->devnode), "%s%d",
+		    BASEPATH, unit);
+		return (0);
+	case SNDCTL_CARDINFO:
+		ci = arg;
+		memset(ci, 0, sizeof(*ci));
+		ci->card = unit;
+		(void)snprintf(ci->shortname, sizeof(ci->shortname),
+		    "mixersim");
+		if (sim->samecard)
+			(void)snprintf(ci->longname, sizeof(ci->longname),
+			    "Simulated mixer");
+		else
+			(void)snprintf(ci->longname, sizeof(ci->longname),
+			    "Simulated mixer %d", unit);
+		return (0);
+	case OSS_SYSINFO:
+		si = arg;
+		memset(si, 0, sizeof(*si));
+		si->nummixers = __builtin_popcount(sim->attached);
+		si->numcards = si->nummixers;
+		return (0);
+	case SOUND_MIXER_READ_STATE:
+		if (sim->nostate)
+			break;
+		st = arg;
+		memset(st, 0, sizeof(*st));
+		st->devmask = u->devmask;
+		st->recmask = u->recmask;
+		st->recsrc = u->recsrc;
+		st->mutedevs = u->mutemask;
+		st->modify_counter = u->counter;
+		for (dev = 0; dev < SOUND_MIXER_NRDEVICES; dev++) {
+			if (MIX_ISSET(dev, u->devmask))
+				st->level[dev] = u->level[dev];
+		}
+		return (0);
+	}
+
+	dev = req & 0xff;
+	if (IOCGROUP(req) != 'M') {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (req == MIXER_READ(dev)) {
+		switch (dev) {
+		case SOUND_MIXER_DEVMASK:
+			*(int *)arg = u->devmask;
+			break;
+		case SOUND_MIXER_RECMASK:
+			*(int *)arg = u->recmask;
+			break;
+		case SOUND_MIXER_RECSRC:
+			*(int *)arg = u->recsrc;
+			break;
+		case SOUND_MIXER_MUTE:
+			*(int *)arg = u->mutemask;
+			break;
+		case SOUND_MIXER_CAPS:
+		case SOUND_MIXER_STEREODEVS:
+			*(int *)arg = 0;
+			break;
+		default:
+			if (dev >= SOUND_MIXER_NRDEVICES ||
+			    !MIX_ISSET(dev, u->devmask)) {
+				errno = EINVAL;
+				return (-1);
+			}
+			*(int *)arg = u->level[dev];
+			break;
+		}
+		return (0);
+	}
+	if (req != MIXER_WRITE(dev)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (sim->nowrite) {
+		errno = EIO;
+		return (-1);
+	}
+
+	v = *(int *)arg;
+	switch (dev) {
+	case SOUND_MIXER_RECSRC:
+		u->recsrc = v & u->recmask;
+		break;
+	case SOUND_MIXER_MUTE:
+		u->mutemask = v & u->devmask;
+		break;
+	case SOUND_MIXER_STEP:
+		dev = v & 0xff;
+		if (sim->nostep || dev >= SOUND_MIXER_NRDEVICES ||
+		    !MIX_ISSET(dev, u->devmask)) {
+			errno = EINVAL;
+			return (-1);
+		}
+		l = (u->level[dev] & 0xff) + (signed char)((v >> 8) & 0xff);
+		r = ((u->level[dev] >> 8) & 0xff) +
+		    (signed char)((v >> 16) & 0xff);
+		l = l < 0 ? 0 : l > 100 ? 100 : l;
+		r = r < 0 ? 0 : r > 100 ? 100 : r;
+		u->level[dev] = l | r << 8;
+		*(int *)arg = u->level[dev];
+		break;
+	default:
+		if (dev >= SOUND_MIXER_NRDEVICES ||
+		    !MIX_ISSET(dev, u->devmask)) {
+			errno = EINVAL;
+			return (-1);
+		}
+		l = v & 0x7f;
+		r = (v >> 8) & 0x7f;
+		u->level[dev] = (l > 100 ? 100 : l) | (r > 100 ? 100 : r) << 8;
+		break;
+	}
+	u->counter++;
+
+	return (0);
+}
+
+/*
+ * Serve a mixer request on a dsp descriptor, following what the patched
+ * dsp_ioctl_channel() does: the stream has a single device, PCM or RECLEV
+ * depending on its direction, and writes to other devices are ignored.
+ */
+static int
+sim_dsp(struct sim_stream *s, unsigned long req, void *arg)
+{
+	int dev, l, r, pcm;
+
+	dev = req & 0xff;
+	pcm = s->rec ? SOUND_MIXER_RECLEV : SOUND_MIXER_PCM;
+	if (req == MIXER_WRITE(dev)) {
+		if (dev == SOUND_MIXER_MUTE) {
+			s->mute = MIX_ISSET(pcm, *(int *)arg);
+		} else if (dev == SOUND_MIXER_RAMP) {
+			l = *(int *)arg;
+			s->ramp = l < 0 ? 0 : l > 10000 ? 10000 : l;
+		} else if (dev == pcm) {
+			l = *(int *)arg & 0x7f;
+			r = (*(int *)arg >> 8) & 0x7f;
+			s->level = (l > 100 ? 100 : l) |
+			    (r > 100 ? 100 : r) << 8;
+		}
+		return (0);
+	}
+	if (req == MIXER_READ(dev)) {
+		switch (dev) {
+		case SOUND_MIXER_MUTE:
+			*(int *)arg = s->mute << pcm;
+			break;
+		case SOUND_MIXER_RAMP:
+			*(int *)arg = s->ramp;
+			break;
+		case SOUND_MIXER_DEVMASK:
+		case SOUND_MIXER_CAPS:
+		case SOUND_MIXER_STEREODEVS:
+			*(int *)arg = 1 << pcm;
+			break;
+		default:
+			*(int *)arg = dev == pcm ? s->level : 0;
+			break;
+		}
+		return (0);
+	}
+	errno = EINVAL;
+
+	return (-1);
+}
+
+int
+sysctlbyname(const char *name, void *old, size_t *oldlen, const void *new,
+    size_t newlen)
+{
+	int unit;
+
+	if (strcmp(name, "hw.snd.default_unit") == 0) {
+		if (old != NULL) {
+			if (*oldlen < sizeof(int)) {
+				errno = ENOMEM;
+				return (-1);
+			}
+			*(int *)old = sim->dunit;
+			*oldlen = sizeof(int);
+		}
+		if (new != NULL) {
+			if (newlen != sizeof(int) || *(const int *)new < 0 ||
+			    *(const int *)new >= sim->nunits) {
+				errno = EINVAL;
+				return (-1);
+			}
+			sim->dunit = *(const int *)new;
+		}
+		return (0);
+	}
+	if (sscanf(name, "dev.pcm.%d.mode", &unit) == 1 && unit >= 0 &&
+	    unit < sim->nunits && MIX_ISSET(unit, sim->attached) &&
+	    old != NULL && *oldlen >= sizeof(int)) {
+		*(int *)old = MIX_MODE_MIXER | MIX_MODE_PLAY | MIX_MODE_REC;
+		*oldlen = sizeof(int);
+		return (0);
+	}
+	if (real_sysctlbyname == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	return (real_sysctlbyname(name, old, oldlen, new, newlen));
+}
@@ -0,0 +1,446 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Load generator for concurrent mixer clients. Every worker thread, in
+ * every worker process, keeps a handle to each of the selected mixers and
+ * issues a weighted random mix of calls on them until the run is over.
+ * Results are kept in a shared mapping, so that the parent can merge the
+ * numbers of all processes.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <mixer.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXUNITS	16
+/* Latency histogram: 16 linear sub-buckets per power of two, in ns. */
+#define HIST_SUB	16
+#define HIST_SIZE	(HIST_SUB * 40)
+
+enum {
+	OP_OPEN = 0,
+	OP_READ,
+	OP_VOL,
+	OP_MUTE,
+	OP_RECSRC,
+	OP_MAX,
+};
+
+static const char *opnames[OP_MAX] = {
+	[OP_OPEN] =	"open",
+	[OP_READ] =	"read",
+	[OP_VOL] =	"vol",
+	[OP_MUTE] =	"mute",
+	[OP_RECSRC] =	"recsrc",
+};
+
+struct opstat {
+	uint64_t ops;
+	uint64_t errs;
+	uint64_t hist[HIST_SIZE];
+};
+
+struct worker {
+	struct opstat st[OP_MAX];
+	uint32_t seed;
+};
+
+static struct shared {
+	volatile int stop;
+	struct worker w[];
+} *shm;
+
+static const char *units[MAXUNITS];
+static int nunits;
+static int weights[OP_MAX] = {
+	[OP_OPEN] =	1,
+	[OP_READ] =	40,
+	[OP_VOL] =	40,
+	[OP_MUTE] =	10,
+	[OP_RECSRC] =	9,
+};
+static int wtotal;
+
+static void usage(void) __dead2;
+static void setweights(char *);
+static void run(int, int, int, int);
+static void *worker(void *);
+static struct mix_dev *pickdev(struct mixer *, uint32_t *, int);
+static int doop(int, struct mixer **, const char *, uint32_t *);
+static uint32_t xrand(uint32_t *);
+static int histidx(uint64_t);
+static double histval(int);
+static double pctl(const struct opstat *, double);
+
+int
+main(int argc, char *argv[])
+{
+	char *p, *unit;
+	int ch, procs = 1, threads = 1, secs = 5, ramp = 0, verbose = 0;
+	int i, t;
+
+	while ((ch = getopt(argc, argv, "d:p:rt:u:vw:")) != -1) {
+		switch (ch) {
+		case 'd':
+			if ((secs = atoi(optarg)) < 1)
+				errx(1, "invalid duration: %s", optarg);
+			break;
+		case 'p':
+			if ((procs = atoi(optarg)) < 1)
+				errx(1, "invalid process count: %s", optarg);
+			break;
+		case 'r':
+			ramp = 1;
+			break;
+		case 't':
+			if ((threads = atoi(optarg)) < 1)
+				errx(1, "invalid thread count: %s", optarg);
+			break;
+		case 'u':
+			p = optarg;
+			while ((unit = strsep(&p, ",")) != NULL) {
+				if (nunits == MAXUNITS)
+					errx(1, "too many units");
+				if (asprintf((char **)&units[nunits++],
+				    "/dev/mixer%s", unit) < 0)
+					err(1, "asprintf");
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'w':
+			setweights(optarg);
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+	/* Use the default mixer. */
+	if (nunits == 0)
+		units[nunits++] = NULL;
+	for (i = 0; i < OP_MAX; i++)
+		wtotal += weights[i];
+	if (wtotal == 0)
+		errx(1, "all weights are zero");
+
+	shm = mmap(NULL, sizeof(struct shared) +
+	    procs * threads * sizeof(struct worker), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANON, -1, 0);
+	if (shm == MAP_FAILED)
+		err(1, "mmap");
+
+	printf("%5s %7s %10s %7s %9s %9s %9s %9s\n", "procs", "threads",
+	    "ops/s", "errs%", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+	/* With -r, double the number of threads per process up to -t. */
+	for (t = ramp ? 1 : threads;; t = MIN(t * 2, threads)) {
+		run(procs, t, secs, verbose);
+		if (t == threads)
+			break;
+	}
+
+	return (0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-rv] [-d secs] [-p procs] [-t threads] "
+	    "[-u unit[,unit...]]\n"
+	    "\t[-w op=weight[,op=weight...]]\n", getprogname());
+	fprintf(stderr, "ops: open, read, vol, mute, recsrc\n");
+	exit(1);
+}
+
+static void
+setweights(char *s)
+{
+	char *tok, *val;
+	int i;
+
+	while ((tok = strsep(&s, ",")) != NULL) {
+		if ((val = strchr(tok, '=')) == NULL)
+			errx(1, "invalid weight: %s", tok);
+		*val++ = '\0';
+		for (i = 0; i < OP_MAX; i++) {
+			if (strcmp(tok, opnames[i]) == 0)
+				break;
+		}
+		if (i == OP_MAX)
+			errx(1, "unknown op: %s", tok);
+		if ((weights[i] = atoi(val)) < 0)
+			errx(1, "invalid weight: %s", val);
+	}
+}
+
+/*
+ * Run one round with `procs` processes of `threads` threads each and print
+ * the merged results.
+ */
+static void
+run(int procs, int threads, int secs, int verbose)
+{
+	struct timespec t0, t1;
+	struct opstat tot, *st;
+	pthread_t *tids;
+	pid_t pid;
+	double elapsed;
+	int i, j, k, n, status;
+
+	n = procs * threads;
+	memset(shm, 0, sizeof(struct shared) + n * sizeof(struct worker));
+	for (i = 0; i < n; i++)
+		shm->w[i].seed = (uint32_t)(i + 1) * 2654435761U;
+
+	if ((tids = calloc(threads, sizeof(pthread_t))) == NULL)
+		err(1, "calloc");
+	(void)clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < procs; i++) {
+		if ((pid = fork()) < 0)
+			err(1, "fork");
+		if (pid != 0)
+			continue;
+		for (j = 0; j < threads; j++) {
+			if ((errno = pthread_create(&tids[j], NULL, worker,
+			    &shm->w[i * threads + j])) != 0)
+				err(1, "pthread_create");
+		}
+		for (j = 0; j < threads; j++)
+			(void)pthread_join(tids[j], NULL);
+		_exit(0);
+	}
+	free(tids);
+	(void)sleep(secs);
+	shm->stop = 1;
+	while (wait(&status) > 0 || errno == EINTR)
+		;
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	memset(&tot, 0, sizeof(tot));
+	for (k = 0; k < OP_MAX; k++) {
+		/* Merge into the first worker, then into the total. */
+		st = &shm->w[0].st[k];
+		for (i = 1; i < n; i++) {
+			st->ops += shm->w[i].st[k].ops;
+			st->errs += shm->w[i].st[k].errs;
+			for (j = 0; j < HIST_SIZE; j++)
+				st->hist[j] += shm->w[i].st[k].hist[j];
+		}
+		tot.ops += st->ops;
+		tot.errs += st->errs;
+		for (j = 0; j < HIST_SIZE; j++)
+			tot.hist[j] += st->hist[j];
+	}
+	printf("%5d %7d %10.0f %7.3f %9.1f %9.1f %9.1f %9.1f\n", procs,
+	    threads, tot.ops / elapsed,
+	    tot.ops ? 100.0 * tot.errs / tot.ops : 0.0, pctl(&tot, 0.5),
+	    pctl(&tot, 0.99), pctl(&tot, 0.999), pctl(&tot, 1.0));
+	if (!verbose)
+		return;
+	for (k = 0; k < OP_MAX; k++) {
+		st = &shm->w[0].st[k];
+		if (st->ops == 0)
+			continue;
+		printf("  %-11s %10.0f %7.3f %9.1f %9.1f %9.1f %9.1f\n",
+		    opnames[k], st->ops / elapsed, 100.0 * st->errs / st->ops,
+		    pctl(st, 0.5), pctl(st, 0.99), pctl(st, 0.999),
+		    pctl(st, 1.0));
+	}
+}
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	struct mixer *m[MAXUNITS];
+	struct timespec t0, t1;
+	uint64_t ns;
+	uint32_t r;
+	int i, op;
+
+	/* Failed opens are retried by the open op. */
+	for (i = 0; i < nunits; i++) {
+		if ((m[i] = mixer_open(units[i])) == NULL)
+			warn("mixer_open(%s)", units[i] ? units[i] : "default");
+	}
+	while (!shm->stop) {
+		r = xrand(&w->seed) % wtotal;
+		for (op = 0; r >= (uint32_t)weights[op]; op++)
+			r -= weights[op];
+		i = xrand(&w->seed) % nunits;
+		(void)clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (doop(op, &m[i], units[i], &w->seed) < 0)
+			w->st[op].errs++;
+		(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+		    (t1.tv_nsec - t0.tv_nsec);
+		w->st[op].ops++;
+		w->st[op].hist[histidx(ns)]++;
+	}
+	for (i = 0; i < nunits; i++) {
+		if (m[i] != NULL)
+			(void)mixer_close(m[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Pick a random device, optionally only among the recording devices.
+ */
+static struct mix_dev *
+pickdev(struct mixer *m, uint32_t *seed, int rec)
+{
+	struct mix_dev *dp;
+	int n = 0, i;
+
+	TAILQ_FOREACH(dp, &m->devs, devs)
+		n += !rec || MIX_ISREC(m, dp->devno);
+	if (n == 0)
+		return (NULL);
+	i = xrand(seed) % n;
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		if ((!rec || MIX_ISREC(m, dp->devno)) && i-- == 0)
+			break;
+	}
+
+	return (dp);
+}
+
+static int
+doop(int op, struct mixer **mp, const char *unit, uint32_t *seed)
+{
+	struct mixer *m = *mp;
+	struct mix_dev *dp;
+	mix_volume_t v;
+	int val;
+
+	if (m == NULL && op != OP_OPEN)
+		return (-1);
+	switch (op) {
+	case OP_OPEN:
+		if (m != NULL)
+			(void)mixer_close(m);
+		*mp = mixer_open(unit);
+		return (*mp == NULL ? -1 : 0);
+	case OP_READ:
+		/* libmixer only reads state in mixer_open(), go direct. */
+		if ((dp = pickdev(m, seed, 0)) == NULL)
+			return (-1);
+		return (ioctl(m->fd, MIXER_READ(dp->devno), &val));
+	case OP_VOL:
+		if ((m->dev = pickdev(m, seed, 0)) == NULL)
+			return (-1);
+		v.left = v.right = MIX_VOLNORM(xrand(seed) % 101);
+		return (mixer_set_vol(m, v));
+	case OP_MUTE:
+		if ((m->dev = pickdev(m, seed, 0)) == NULL)
+			return (-1);
+		return (mixer_set_mute(m, MIX_TOGGLEMUTE));
+	case OP_RECSRC:
+		if ((m->dev = pickdev(m, seed, 1)) == NULL)
+			return (-1);
+		return (mixer_mod_recsrc(m, xrand(seed) & 1 ?
+		    MIX_ADDRECSRC : MIX_REMOVERECSRC));
+	}
+
+	return (-1);
+}
+
+/* xorshift32, each worker has its own state. */
+static uint32_t
+xrand(uint32_t *s)
+{
+	uint32_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return (*s = x);
+}
+
+static int
+histidx(uint64_t ns)
+{
+	int e;
+
+	if (ns < HIST_SUB)
+		return (ns);
+	e = 63 - __builtin_clzll(ns);
+	if (e >= HIST_SIZE / HIST_SUB + 3)
+		return (HIST_SIZE - 1);
+
+	return ((e - 3) * HIST_SUB + ((ns >> (e - 4)) & (HIST_SUB - 1)));
+}
+
+/* Upper bound of a bucket, in usec. */
+static double
+histval(int i)
+{
+	int e;
+
+	if (i < HIST_SUB)
+		return ((i + 1) / 1e3);
+	e = i / HIST_SUB + 3;
+
+	return ((((uint64_t)(HIST_SUB + i % HIST_SUB + 1)) << (e - 4)) / 1e3);
+}
+
+static double
+pctl(const struct opstat *st, double q)
+{
+	uint64_t n, want;
+	int i;
+
+	if (st->ops == 0)
+		return (0);
+	want = q * st->ops;
+	if (want == 0)
+		want = 1;
+	for (i = 0, n = 0; i < HIST_SIZE; i++) {
+		if ((n += st->hist[i]) >= want)
+			return (histval(i));
+	}
+
+	return (histval(HIST_SIZE - 1));
+}
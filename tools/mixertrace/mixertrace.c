@@ -0,0 +1,379 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Record the libmixer calls a program makes, to be played back with
+ * mixerreplay(8). Load with LD_PRELOAD; the trace is written to the file
+ * named by MIXERTRACE_FILE, or "mixer.trace".
+ *
+ * Each call is one line:
+ *
+ *	usec op handle rc args...
+ *
+ * where usec is the time since the first call, handle the number of the
+ * mixer ("-" for calls without one) and rc the return value. A mixer gets
+ * the lowest number no other open mixer has, so the numbers of closed
+ * mixers are given out again. Lookups that never reach the driver (mixer_get_dev()
+ * and friends) are not recorded, and neither are the calls libmixer makes
+ * to itself.
+ */
+
+#include <sys/types.h>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mixer.h>
+
+#define REC_MAXHANDLES	256
+
+static const char *devnames[] = SOUND_DEVICE_NAMES;
+
+static pthread_mutex_t rec_mtx = PTHREAD_MUTEX_INITIALIZER;
+static FILE *rec_fp;
+static struct timespec rec_t0;
+static struct mixer *rec_handles[REC_MAXHANDLES];
+static int rec_nhandles;
+static __thread int rec_depth;
+
+static struct mixer *(*real_open)(const char *);
+static int (*real_close)(struct mixer *);
+static int (*real_set_vol)(struct mixer *, mix_volume_t);
+static int (*real_step_vol)(struct mixer *, struct mix_dev *, float, float);
+static int (*real_set_mute)(struct mixer *, int);
+static int (*real_mod_recsrc)(struct mixer *, int);
+static int (*real_set_mutemask)(struct mixer *, int, int);
+static int (*real_set_recsrcmask)(struct mixer *, int, int);
+static int (*real_get_dunit)(void);
+static int (*real_set_dunit)(struct mixer *, int);
+static int (*real_get_mode)(int);
+static int (*real_get_nmixers)(void);
+static int (*real_submit)(struct mixer *, mix_op_t *);
+
+static void rec_init(void) __attribute__((constructor));
+static int rec_handle(struct mixer *);
+static int _rec_handle(struct mixer *, int);
+static void rec_log(struct timespec *, const char *, int, int, const char *,
+    ...) __printflike(5, 6);
+
+static void
+rec_init(void)
+{
+	const char *path;
+
+	real_open = dlsym(RTLD_NEXT, "mixer_open");
+	real_close = dlsym(RTLD_NEXT, "mixer_close");
+	real_set_vol = dlsym(RTLD_NEXT, "mixer_set_vol");
+	real_step_vol = dlsym(RTLD_NEXT, "mixer_step_vol");
+	real_set_mute = dlsym(RTLD_NEXT, "mixer_set_mute");
+	real_mod_recsrc = dlsym(RTLD_NEXT, "mixer_mod_recsrc");
+	real_set_mutemask = dlsym(RTLD_NEXT, "mixer_set_mutemask");
+	real_set_recsrcmask = dlsym(RTLD_NEXT, "mixer_set_recsrcmask");
+	real_get_dunit = dlsym(RTLD_NEXT, "mixer_get_dunit");
+	real_set_dunit = dlsym(RTLD_NEXT, "mixer_set_dunit");
+	real_get_mode = dlsym(RTLD_NEXT, "mixer_get_mode");
+	real_get_nmixers = dlsym(RTLD_NEXT, "mixer_get_nmixers");
+	real_submit = dlsym(RTLD_NEXT, "mixer_submit");
+
+	if ((path = getenv("MIXERTRACE_FILE")) == NULL)
+		path = "mixer.trace";
+	if ((rec_fp = fopen(path, "w")) != NULL)
+		setvbuf(rec_fp, NULL, _IOLBF, 0);
+	(void)clock_gettime(CLOCK_MONOTONIC, &rec_t0);
+}
+
+/*
+ * Return the number of a mixer, assigning one if it is new.
+ */
+static int
+rec_handle(struct mixer *m)
+{
+	int h;
+
+	if (m == NULL)
+		return (-1);
+	(void)pthread_mutex_lock(&rec_mtx);
+	h = _rec_handle(m, 1);
+	(void)pthread_mutex_unlock(&rec_mtx);
+
+	return (h);
+}
+
+/*
+ * Look up the number of a mixer, or -1. If `assign` is set, a mixer without
+ * one gets the first free number.
+ */
+static int
+_rec_handle(struct mixer *m, int assign)
+{
+	int i, h = -1;
+
+	for (i = 0; i < rec_nhandles; i++) {
+		if (rec_handles[i] == m)
+			return (i);
+		if (rec_handles[i] == NULL && h < 0)
+			h = i;
+	}
+	if (!assign)
+		return (-1);
+	if (h < 0) {
+		if (rec_nhandles == REC_MAXHANDLES)
+			return (-1);
+		h = rec_nhandles++;
+	}
+	rec_handles[h] = m;
+
+	return (h);
+}
+
+static void
+rec_log(struct timespec *ts, const char *op, int h, int rc, const char *fmt,
+    ...)
+{
+	va_list ap;
+	long long usec;
+
+	if (rec_fp == NULL)
+		return;
+	usec = (ts->tv_sec - rec_t0.tv_sec) * 1000000LL +
+	    (ts->tv_nsec - rec_t0.tv_nsec) / 1000;
+	(void)pthread_mutex_lock(&rec_mtx);
+	if (h >= 0)
+		fprintf(rec_fp, "%lld %s %d %d", usec, op, h, rc);
+	else
+		fprintf(rec_fp, "%lld %s - %d", usec, op, rc);
+	if (fmt != NULL) {
+		fputc(' ', rec_fp);
+		va_start(ap, fmt);
+		vfprintf(rec_fp, fmt, ap);
+		va_end(ap);
+	}
+	fputc('\n', rec_fp);
+	(void)pthread_mutex_unlock(&rec_mtx);
+}
+
+/*
+ * Wrap a call: time it and only log it if it was not made by libmixer
+ * itself.
+ */
+#define REC_CALL(rv, call) do {						\
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);			\
+	rec_depth++;							\
+	rv = call;							\
+	rec_depth--;							\
+} while (0)
+
+struct mixer *
+mixer_open(const char *name)
+{
+	struct timespec ts;
+	struct mixer *m;
+
+	REC_CALL(m, real_open(name));
+	if (rec_depth == 0)
+		rec_log(&ts, "open", rec_handle(m), m == NULL ? -1 : 0, "%s",
+		    name == NULL ? "-" : name);
+
+	return (m);
+}
+
+int
+mixer_close(struct mixer *m)
+{
+	struct timespec ts;
+	int h, rc;
+
+	/* Forget `m` now, the next mixer_open() may return it again. */
+	(void)pthread_mutex_lock(&rec_mtx);
+	if ((h = _rec_handle(m, 0)) >= 0)
+		rec_handles[h] = NULL;
+	(void)pthread_mutex_unlock(&rec_mtx);
+	REC_CALL(rc, real_close(m));
+	if (rec_depth == 0)
+		rec_log(&ts, "close", h, rc, NULL);
+
+	return (rc);
+}
+
+int
+mixer_set_vol(struct mixer *m, mix_volume_t vol)
+{
+	struct timespec ts;
+	const char *dev;
+	int rc;
+
+	dev = m->dev->name;
+	REC_CALL(rc, real_set_vol(m, vol));
+	if (rec_depth == 0)
+		rec_log(&ts, "setvol", rec_handle(m), rc, "%s %.4f %.4f",
+		    dev, vol.left, vol.right);
+
+	return (rc);
+}
+
+int
+mixer_step_vol(struct mixer *m, struct mix_dev *dev, float left, float right)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_step_vol(m, dev, left, right));
+	if (rec_depth == 0)
+		rec_log(&ts, "stepvol", rec_handle(m), rc, "%s %.4f %.4f",
+		    dev->name, left, right);
+
+	return (rc);
+}
+
+int
+mixer_set_mute(struct mixer *m, int opt)
+{
+	struct timespec ts;
+	const char *dev;
+	int rc;
+
+	dev = m->dev->name;
+	REC_CALL(rc, real_set_mute(m, opt));
+	if (rec_depth == 0)
+		rec_log(&ts, "setmute", rec_handle(m), rc, "%s %#x", dev, opt);
+
+	return (rc);
+}
+
+int
+mixer_mod_recsrc(struct mixer *m, int opt)
+{
+	struct timespec ts;
+	const char *dev;
+	int rc;
+
+	dev = m->dev->name;
+	REC_CALL(rc, real_mod_recsrc(m, opt));
+	if (rec_depth == 0)
+		rec_log(&ts, "modrecsrc", rec_handle(m), rc, "%s %#x", dev,
+		    opt);
+
+	return (rc);
+}
+
+int
+mixer_set_mutemask(struct mixer *m, int mask, int opt)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_set_mutemask(m, mask, opt));
+	if (rec_depth == 0)
+		rec_log(&ts, "mutemask", rec_handle(m), rc, "%#x %#x", mask,
+		    opt);
+
+	return (rc);
+}
+
+int
+mixer_set_recsrcmask(struct mixer *m, int mask, int opt)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_set_recsrcmask(m, mask, opt));
+	if (rec_depth == 0)
+		rec_log(&ts, "recsrcmask", rec_handle(m), rc, "%#x %#x", mask,
+		    opt);
+
+	return (rc);
+}
+
+int
+mixer_get_dunit(void)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_get_dunit());
+	if (rec_depth == 0)
+		rec_log(&ts, "getdunit", -1, rc, NULL);
+
+	return (rc);
+}
+
+int
+mixer_set_dunit(struct mixer *m, int unit)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_set_dunit(m, unit));
+	if (rec_depth == 0)
+		rec_log(&ts, "setdunit", rec_handle(m), rc, "%d", unit);
+
+	return (rc);
+}
+
+int
+mixer_get_mode(int unit)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_get_mode(unit));
+	if (rec_depth == 0)
+		rec_log(&ts, "getmode", -1, rc, "%d", unit);
+
+	return (rc);
+}
+
+int
+mixer_get_nmixers(void)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_get_nmixers());
+	if (rec_depth == 0)
+		rec_log(&ts, "nmixers", -1, rc, NULL);
+
+	return (rc);
+}
+
+int
+mixer_submit(struct mixer *m, mix_op_t *op)
+{
+	struct timespec ts;
+	int rc;
+
+	REC_CALL(rc, real_submit(m, op));
+	if (rec_depth == 0 && op->devno >= 0 &&
+	    op->devno < SOUND_MIXER_NRDEVICES)
+		rec_log(&ts, "submit", rec_handle(m), rc, "%s %d %#x %.4f %.4f",
+		    devnames[op->devno], op->type, op->opt, op->vol.left,
+		    op->vol.right);
+
+	return (rc);
+}
@@ -0,0 +1,264 @@
+/*-
+ * Copyright (c) 2021 Christos Margiolis <christos@FreeBSD.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Build the gain ramp of feeder_volume in userland, check it against the
+ * formula it is meant to follow, sample for sample, and time it.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* From sys/dev/sound/pcm/matrix.h and channel.h. */
+#define SND_CHN_T_VOL_MAX	19
+#define SND_VOL_RESOLUTION	8
+#define SND_VOL_FLAT		(1 << SND_VOL_RESOLUTION)
+
+#include <dev/sound/pcm/feeder_volramp.h>
+
+#define MAXCHAN			(SND_CHN_T_VOL_MAX - 1)
+
+static int matrix[MAXCHAN];
+
+static void usage(void) __dead2;
+static void apply_s16(int *, int *, uint32_t, uint8_t *, uint32_t);
+static int16_t scale(int16_t, int);
+static unsigned long check(int, int, unsigned long *);
+static double bench(int, uint32_t, int, uint32_t, int);
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long nframes, bad;
+	double flat, ramp;
+	uint32_t frames = 4096, rate = 48000;
+	int ch, i, nchan = 2, loops = 10000, ms = 50;
+
+	while ((ch = getopt(argc, argv, "c:f:n:r:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			nchan = atoi(optarg);
+			if (nchan < 1 || nchan > MAXCHAN)
+				errx(1, "invalid channel count: %s", optarg);
+			break;
+		case 'f':
+			if ((frames = strtoul(optarg, NULL, 10)) == 0)
+				errx(1, "invalid frame count: %s", optarg);
+			break;
+		case 'n':
+			if ((loops = atoi(optarg)) < 1)
+				errx(1, "invalid loop count: %s", optarg);
+			break;
+		case 'r':
+			if ((ms = atoi(optarg)) < 1)
+				errx(1, "invalid ramp length: %s", optarg);
+			break;
+		case 's':
+			if ((rate = strtoul(optarg, NULL, 10)) == 0)
+				errx(1, "invalid rate: %s", optarg);
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	for (i = 0; i < MAXCHAN; i++)
+		matrix[i] = i;
+
+	bad = check(nchan, 1000, &nframes);
+	printf("check: %lu frames, %lu mismatches\n", nframes, bad);
+
+	flat = bench(nchan, frames, loops, rate, 0);
+	ramp = bench(nchan, frames, loops, rate, ms);
+	printf("%-6s %10s %10s\n", "", "ns/frame", "Mframes/s");
+	printf("%-6s %10.3f %10.1f\n", "flat", flat, 1e3 / flat);
+	printf("%-6s %10.3f %10.1f\n", "ramp", ramp, 1e3 / ramp);
+
+	return (bad != 0);
+}
+
+static void __dead2
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-c channels] [-f frames] [-n loops] "
+	    "[-r ms] [-s rate]\n", getprogname());
+	exit(1);
+}
+
+/*
+ * Same as the signed 16-bit kernel of feeder_volume.c, which goes through
+ * the buffer backwards.
+ */
+static void
+apply_s16(int *vol, int *mat, uint32_t channels, uint8_t *dst, uint32_t count)
+{
+	int16_t *p;
+	uint32_t i;
+
+	p = (int16_t *)dst + count * channels;
+	do {
+		i = channels;
+		do {
+			p--;
+			i--;
+			*p = scale(*p, vol[mat[i]]);
+		} while (i != 0);
+	} while (--count != 0);
+}
+
+static int16_t
+scale(int16_t x, int v)
+{
+	int32_t y;
+
+	y = ((int32_t)x * v) >> SND_VOL_RESOLUTION;
+	if (y > INT16_MAX)
+		return (INT16_MAX);
+	if (y < INT16_MIN)
+		return (INT16_MIN);
+
+	return (y);
+}
+
+/*
+ * Retarget the ramp `nramps` times, with random gains, ramp lengths and
+ * buffer sizes, and compare every sample with what the formula gives.
+ */
+static unsigned long
+check(int nchan, int nramps, unsigned long *nframes)
+{
+	struct feed_volramp r;
+	int16_t buf[4096 * MAXCHAN], in[4096 * MAXCHAN];
+	int vol[SND_CHN_T_VOL_MAX];
+	int start[MAXCHAN], target[MAXCHAN], last[MAXCHAN];
+	unsigned long bad = 0;
+	uint32_t f, len, nb, n, k;
+	int c, g, i;
+
+	memset(&r, 0, sizeof(r));
+	memset(last, 0, sizeof(last));
+	srandom(1);
+	*nframes = 0;
+	for (i = 0; i < nramps; i++) {
+		for (c = 0; c < SND_CHN_T_VOL_MAX; c++)
+			vol[c] = random() % (2 * SND_VOL_FLAT + 1);
+		len = random() % 3 == 0 ? 0 : random() % 8192;
+		feed_volramp_set(&r, vol, len);
+		if (i == 0)
+			len = 0;
+		nb = (len + FVR_BLOCK - 1) / FVR_BLOCK;
+		for (c = 0; c < nchan; c++) {
+			start[c] = last[c];
+			target[c] = vol[c];
+			if (nb == 0)
+				last[c] = vol[c];
+		}
+
+		/* Run into the ramp, and sometimes past it. */
+		f = 0;
+		len = random() % (len + 2048);
+		while (f < len) {
+			n = 1 + random() % 4096;
+			if (n > len - f)
+				n = len - f;
+			for (k = 0; k < n * nchan; k++)
+				in[k] = buf[k] = random();
+			feed_volramp_apply(&r, apply_s16, matrix, nchan,
+			    nchan * sizeof(int16_t), (uint8_t *)buf, n);
+			for (k = 0; k < n; k++, f++) {
+				for (c = 0; c < nchan; c++) {
+					if (f / FVR_BLOCK < nb)
+						g = start[c] + (target[c] -
+						    start[c]) *
+						    (int)(f / FVR_BLOCK + 1) /
+						    (int)nb;
+					else
+						g = target[c];
+					last[c] = g;
+					if (buf[k * nchan + c] !=
+					    scale(in[k * nchan + c], g))
+						bad++;
+				}
+			}
+			*nframes += n;
+		}
+	}
+
+	return (bad);
+}
+
+/*
+ * Return the time per frame of processing `frames` frames at a time, with
+ * the gain ramping back and forth over `ms` milliseconds, or constant if
+ * `ms` is 0.
+ */
+static double
+bench(int nchan, uint32_t frames, int loops, uint32_t rate, int ms)
+{
+	struct feed_volramp r;
+	struct timespec t0, t1;
+	int16_t *buf;
+	int vol[2][SND_CHN_T_VOL_MAX];
+	uint32_t k, len, done;
+	int c, i;
+
+	if ((buf = malloc(frames * nchan * sizeof(int16_t))) == NULL)
+		err(1, "malloc");
+	for (k = 0; k < frames * nchan; k++)
+		buf[k] = random();
+	for (c = 0; c < SND_CHN_T_VOL_MAX; c++) {
+		vol[0][c] = SND_VOL_FLAT / 4;
+		vol[1][c] = SND_VOL_FLAT / 2;
+	}
+	memset(&r, 0, sizeof(r));
+	feed_volramp_set(&r, vol[0], 0);
+	len = (uint64_t)ms * rate / 1000;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &t0);
+	done = len;
+	for (i = 0; i < loops; i++) {
+		if (ms != 0 && done >= len) {
+			feed_volramp_set(&r, vol[i & 1], len);
+			done = 0;
+		}
+		feed_volramp_apply(&r, apply_s16, matrix, nchan,
+		    nchan * sizeof(int16_t), (uint8_t *)buf, frames);
+		done += frames;
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &t1);
+	free(buf);
+
+	return (((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+	    ((double)loops * frames));
+}
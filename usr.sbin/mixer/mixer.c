@@ -30,19 +30,70 @@
 #include <string.h>
 #include <unistd.h>
 
+#define	_PATH_MIXERPRESETS	"/etc/mixer.presets"
+
+#ifdef MIXER_PROBES
+#include "mixer_probes.h"
+#else
+#define	MIXERCMD_CMD_ENTRY(arg)
+#define	MIXERCMD_CMD_RETURN(arg)
+#define	MIXERCMD_PLAN_ENTRY(nmod)
+#define	MIXERCMD_PLAN_RETURN(nmod, nerr)
+#endif
+
 enum {
 	C_VOL = 0,
 	C_MUT,
 	C_SRC,
 };
 
+/*
+ * Modifications are not applied as soon as they are parsed. They are played
+ * against a copy of the mixer's state instead, and planrun() then writes only
+ * the difference between that copy and the device, so that redundant or
+ * cancelling arguments cost nothing.
+ */
+static struct plan {
+	mix_volume_t vol[SOUND_MIXER_NRDEVICES];	/* target volumes */
+	mix_volume_t step[SOUND_MIXER_NRDEVICES];	/* sum of relative steps */
+	int relmask;				/* devices with only relative steps */
+	int mutemask;				/* target mute mask */
+	int recsrc;				/* target recording sources */
+	int nmod;				/* number of modified controls */
+	struct {
+		int devno;
+		int ctl;
+	} mod[SOUND_MIXER_NRDEVICES * 3];	/* modified controls, in order */
+	/* Filled in by planwrite() for planprint(). */
+	mix_volume_t prev[SOUND_MIXER_NRDEVICES];	/* volumes before */
+	int verr[SOUND_MIXER_NRDEVICES];	/* volume write errors */
+	int pmute;				/* mute mask before */
+	int psrc;				/* recording sources before */
+	int merr;				/* mute mask write error */
+	int serr;				/* recsrc mask write error */
+} plan;
+
 static void usage(void) __dead2;
 static void initctls(struct mixer *);
+static int parseargs(struct mixer *, int, char *[]);
+static void allmixers(int, char *[], int, int);
+static int groupwrite(struct mixer *, int, void *);
 static void printall(struct mixer *, int);
 static void printminfo(struct mixer *, int);
 static void printdev(struct mixer *, int);
 static void printrecsrc(struct mixer *, int); /* XXX: change name */
 static int set_dunit(struct mixer *, int);
+static int muteopt(char);
+static int recsrcopt(char);
+static int stepvol(float, float);
+static void planadd(struct mix_dev *, int);
+static int planwrite(struct mixer *, struct plan *);
+static void planprint(struct mixer *, struct plan *, const char *);
+static void planrun(struct mixer *);
+static int parsevol(const char *, mix_volume_t *);
+static struct mix_preset *loadpreset(struct mixer *, const char *,
+    const char *);
+static void applypreset(struct mixer *, const char *, const char *);
 /* Control handlers */
 static int mod_volume(struct mix_dev *, void *);
 static int mod_mute(struct mix_dev *, void *);
@@ -55,14 +106,13 @@ int
 main(int argc, char *argv[])
 {
 	struct mixer *m;
-	mix_ctl_t *cp;
-	char *name = NULL, buf[NAME_MAX];
-	char *p, *q, *devstr, *ctlstr, *valstr = NULL;
-	int dunit, i, n, pall = 1, shorthand;
+	char *name = NULL;
+	const char *pfile = _PATH_MIXERPRESETS, *pname = NULL;
+	int dunit, pall = 1;
 	int aflag = 0, dflag = 0, oflag = 0, sflag = 0;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "ad:f:hos")) != -1) {
+	while ((ch = getopt(argc, argv, "ad:f:hoP:p:s")) != -1) {
 		switch (ch) {
 		case 'a':
 			aflag = 1;
@@ -79,6 +129,12 @@ main(int argc, char *argv[])
 		case 'o':
 			oflag = 1;
 			break;
+		case 'P':
+			pfile = optarg;
+			break;
+		case 'p':
+			pname = optarg;
+			break;
 		case 's':
 			sflag = 1;
 			break;
@@ -91,24 +147,10 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	/* Print all mixers and exit. */
 	if (aflag) {
-		if ((n = mixer_get_nmixers()) < 0)
-			err(1, "mixer_get_nmixers");
-		for (i = 0; i < n; i++) {
-			(void)snprintf(buf, sizeof(buf), "/dev/mixer%d", i);
-			if ((m = mixer_open(buf)) == NULL)
-				err(1, "mixer_open: %s", buf);
-			initctls(m);
-			if (sflag)
-				printrecsrc(m, oflag);
-			else {
-				printall(m, oflag);
-				if (oflag)
-					printf("\n");
-			}
-			(void)mixer_close(m);
-		}
+		if (pname != NULL)
+			usage();
+		allmixers(argc, argv, oflag, sflag);
 		return (0);
 	}
 
@@ -126,64 +168,12 @@ main(int argc, char *argv[])
 	}
 
 parse:
-	while (argc > 0) {
-		if ((p = strdup(*argv)) == NULL)
-			err(1, "strdup(%s)", *argv);
-
-		/* Check if we're using the shorthand syntax for volume setting. */
-		shorthand = 0;
-		for (q = p; *q != '\0'; q++) {
-			if (*q == '=') {
-				q++;
-				shorthand = ((*q >= '0' && *q <= '9') ||
-				    *q == '+' || *q == '-' || *q == '.');
-				break;
-			} else if (*q == '.')
-				break;
-		}
-
-		/* Split the string into device, control and value. */
-		devstr = strsep(&p, ".=");
-		if ((m->dev = mixer_get_dev_byname(m, devstr)) == NULL) {
-			warnx("%s: no such device", devstr);
-			goto next;
-		}
-		/* Input: `dev`. */
-		if (p == NULL) {
-			printdev(m, 1);
-			pall = 0;
-			goto next;
-		} else if (shorthand) {
-			/*
-			 * Input: `dev=N` -> shorthand for `dev.volume=N`.
-			 *
-			 * We don't care what the rest of the string contains as
-			 * long as we're sure the very beginning is right,
-			 * mod_volume() will take care of parsing it properly.
-			 */
-			cp = mixer_get_ctl(m->dev, C_VOL);
-			cp->mod(cp->parent_dev, p);
-			goto next;
-		}
-		ctlstr = strsep(&p, "=");
-		if ((cp = mixer_get_ctl_byname(m->dev, ctlstr)) == NULL) {
-			warnx("%s.%s: no such control", devstr, ctlstr);
-			goto next;
-		}
-		/* Input: `dev.control`. */
-		if (p == NULL) {
-			(void)cp->print(cp->parent_dev, cp->name);
-			pall = 0;
-			goto next;
-		}
-		valstr = p;
-		/* Input: `dev.control=val`. */
-		cp->mod(cp->parent_dev, valstr);
-next:
-		free(p);
-		argc--;
-		argv++;
+	if (pname != NULL) {
+		applypreset(m, pfile, pname);
+		pall = 0;
 	}
+	pall &= parseargs(m, argc, argv);
+	planrun(m);
 
 	if (pall)
 		printall(m, oflag);
@@ -195,8 +185,10 @@ next:
 static void __dead2
 usage(void)
 {
-	fprintf(stderr, "usage: %1$s [-f device] [-d unit] [-os] [dev[.control[=value]]] ...\n"
-	    "       %1$s [-d unit] [-os] -a\n"
+	fprintf(stderr, "usage: %1$s [-f device] [-d unit] [-os] [-P file] "
+	    "[-p preset]\n"
+	    "             [dev[.control[=value]]] ...\n"
+	    "       %1$s [-os] -a [dev.control=value] ...\n"
 	    "       %1$s -h\n", getprogname());
 	exit(1);
 }
@@ -279,7 +271,8 @@ printdev(struct mixer *m, int oflag)
 		printf("\n");
 	} else {
 		TAILQ_FOREACH(cp, &d->ctls, ctls) {
-			(void)cp->print(cp->parent_dev, cp->name);
+			(void)cp->print(cp->parent_dev,
+			    __DECONST(char *, cp->name));
 		}
 	}
 }
@@ -326,18 +319,576 @@ set_dunit(struct mixer *m, int dunit)
 }
 
 static int
-mod_volume(struct mix_dev *d, void *p)
+muteopt(char c)
+{
+	switch (c) {
+	case '0':
+		return (MIX_UNMUTE);
+	case '1':
+		return (MIX_MUTE);
+	case '^':
+		return (MIX_TOGGLEMUTE);
+	default:
+		return (-1);
+	}
+}
+
+static int
+recsrcopt(char c)
+{
+	switch (c) {
+	case '+':
+		return (MIX_ADDRECSRC);
+	case '-':
+		return (MIX_REMOVERECSRC);
+	case '=':
+		return (MIX_SETRECSRC);
+	case '^':
+		return (MIX_TOGGLERECSRC);
+	default:
+		return (-1);
+	}
+}
+
+/*
+ * Return the level, from 0 to 100, that stepping `vol` by `step` results in,
+ * or -1 if the step is too large to be sent as one.
+ */
+static int
+stepvol(float vol, float step)
+{
+	int v;
+
+	if (step < -MIX_VOLMAX || step > MIX_VOLMAX)
+		return (-1);
+	v = MIX_VOLDENORM(vol) +
+	    (step < 0 ? -MIX_VOLDENORM(-step) : MIX_VOLDENORM(step));
+	if (v < 0)
+		v = 0;
+	else if (v > 100)
+		v = 100;
+
+	return (v);
+}
+
+/*
+ * Record that a control has been modified. The first modification in a plan
+ * takes a copy of the mixer's current state.
+ */
+static void
+planadd(struct mix_dev *d, int ctl)
+{
+	struct mixer *m = d->parent_mixer;
+	struct mix_dev *dp;
+	int i;
+
+	if (plan.nmod == 0) {
+		TAILQ_FOREACH(dp, &m->devs, devs)
+			plan.vol[dp->devno] = dp->vol;
+		memset(plan.step, 0, sizeof(plan.step));
+		plan.relmask = m->devmask;
+		plan.mutemask = m->mutemask;
+		plan.recsrc = m->recsrc;
+	}
+	for (i = 0; i < plan.nmod; i++) {
+		if (plan.mod[i].devno == d->devno && plan.mod[i].ctl == ctl)
+			return;
+	}
+	plan.mod[plan.nmod].devno = d->devno;
+	plan.mod[plan.nmod].ctl = ctl;
+	plan.nmod++;
+}
+
+/*
+ * Apply the planned state with the fewest possible writes: one per device
+ * whose volume actually changes, and at most one for each mask. A mask write
+ * that mutes something goes first, so that the volume changes are not heard;
+ * otherwise masks are written after the volumes.
+ */
+static int
+planwrite(struct mixer *m, struct plan *p)
+{
+	struct mix_dev *dp;
+	mix_volume_t *v;
+	int rc, done = 0, nerr = 0;
+
+	if (p->nmod == 0)
+		return (0);
+	MIXERCMD_PLAN_ENTRY(p->nmod);
+	p->pmute = m->mutemask;
+	p->psrc = m->recsrc;
+	p->merr = p->serr = 0;
+	if (p->mutemask & ~m->mutemask) {
+		if (mixer_set_mutemask(m, p->mutemask, MIX_SETMUTE) < 0)
+			p->merr = errno;
+		done = 1;
+	}
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		p->prev[dp->devno] = dp->vol;
+		p->verr[dp->devno] = 0;
+		v = &p->vol[dp->devno];
+		if (MIX_VOLDENORM(v->left) == MIX_VOLDENORM(dp->vol.left) &&
+		    MIX_VOLDENORM(v->right) == MIX_VOLDENORM(dp->vol.right))
+			continue;
+		m->dev = dp;
+		/*
+		 * Purely relative changes are sent as a single step, so that
+		 * they cannot race with other writers, unless clamping in
+		 * between the steps made the result differ from the sum.
+		 * Where a step cannot be taken, e.g. on a mixer given by a
+		 * path other than /dev/mixerN, or when it keeps losing the
+		 * race, the volume computed from the cached state is set as
+		 * it always was.
+		 */
+		rc = -1;
+		errno = EOPNOTSUPP;
+		if (MIX_ISSET(dp->devno, p->relmask) &&
+		    stepvol(dp->vol.left, p->step[dp->devno].left) ==
+		    MIX_VOLDENORM(v->left) &&
+		    stepvol(dp->vol.right, p->step[dp->devno].right) ==
+		    MIX_VOLDENORM(v->right))
+			rc = mixer_step_vol(m, dp, p->step[dp->devno].left,
+			    p->step[dp->devno].right);
+		if (rc < 0 && (errno == EOPNOTSUPP || errno == EAGAIN))
+			rc = mixer_set_vol(m, *v);
+		if (rc < 0) {
+			p->verr[dp->devno] = errno;
+			nerr++;
+		}
+	}
+	if (!done && p->mutemask != m->mutemask &&
+	    mixer_set_mutemask(m, p->mutemask, MIX_SETMUTE) < 0)
+		p->merr = errno;
+	if (p->recsrc != m->recsrc &&
+	    mixer_set_recsrcmask(m, p->recsrc, MIX_SETRECSRC) < 0)
+		p->serr = errno;
+	nerr += (p->merr != 0) + (p->serr != 0);
+	MIXERCMD_PLAN_RETURN(p->nmod, nerr);
+
+	return (nerr);
+}
+
+/*
+ * Print a line for every control the plan modified, prefixed with `pfx`,
+ * and start a new plan.
+ */
+static void
+planprint(struct mixer *m, struct plan *p, const char *pfx)
+{
+	struct mix_dev *dp;
+	mix_volume_t *v;
+	int i, n, o;
+	const char *ctl;
+
+	for (i = 0; i < p->nmod; i++) {
+		n = p->mod[i].devno;
+		TAILQ_FOREACH(dp, &m->devs, devs) {
+			if (dp->devno == n)
+				break;
+		}
+		ctl = mixer_get_ctl(dp, p->mod[i].ctl)->name;
+		switch (p->mod[i].ctl) {
+		case C_VOL:
+			v = &p->vol[n];
+			if ((errno = p->verr[n]) != 0)
+				warn("%s%s.%s=%.2f:%.2f", pfx,
+				    dp->name, ctl, v->left, v->right);
+			else
+				printf("%s%s.%s: %.2f:%.2f -> %.2f:%.2f\n",
+				    pfx, dp->name, ctl, p->prev[n].left,
+				    p->prev[n].right, dp->vol.left,
+				    dp->vol.right);
+			break;
+		case C_MUT:
+		case C_SRC:
+			if (p->mod[i].ctl == C_MUT) {
+				o = MIX_ISSET(n, p->pmute);
+				errno = p->merr;
+			} else {
+				o = MIX_ISSET(n, p->psrc);
+				errno = p->serr;
+			}
+			if (errno != 0)
+				warn("%s%s.%s=%d", pfx, dp->name, ctl,
+				    MIX_ISSET(n, p->mod[i].ctl == C_MUT ?
+				    p->mutemask : p->recsrc));
+			else
+				printf("%s%s.%s: %d -> %d\n", pfx, dp->name,
+				    ctl, o,
+				    MIX_ISSET(n, p->mod[i].ctl == C_MUT ?
+				    m->mutemask : m->recsrc));
+			break;
+		}
+	}
+	p->nmod = 0;
+}
+
+/*
+ * Apply the current plan and print what it changed.
+ */
+static void
+planrun(struct mixer *m)
+{
+	if (plan.nmod == 0)
+		return;
+	(void)planwrite(m, &plan);
+	planprint(m, &plan, "");
+}
+
+/*
+ * Handle the arguments for `m`. Modifications are added to the plan, and
+ * arguments that display something run the plan first. Returns 0 if any
+ * argument displayed something, otherwise 1.
+ */
+static int
+parseargs(struct mixer *m, int argc, char *argv[])
 {
-	struct mixer *m;
 	mix_ctl_t *cp;
-	mix_volume_t v;
+	char *arg, *p, *q, *devstr, *ctlstr, *valstr;
+	int pall = 1, shorthand;
+
+	while (argc > 0) {
+		if ((p = arg = strdup(*argv)) == NULL)
+			err(1, "strdup(%s)", *argv);
+		MIXERCMD_CMD_ENTRY(*argv);
+
+		/* Check if we're using the shorthand syntax for volume setting. */
+		shorthand = 0;
+		for (q = p; *q != '\0'; q++) {
+			if (*q == '=') {
+				q++;
+				shorthand = ((*q >= '0' && *q <= '9') ||
+				    *q == '+' || *q == '-' || *q == '.');
+				break;
+			} else if (*q == '.')
+				break;
+		}
+
+		/* Split the string into device, control and value. */
+		devstr = strsep(&p, ".=");
+		if ((m->dev = mixer_get_dev_byname(m, devstr)) == NULL) {
+			warnx("%s: no such device", devstr);
+			goto next;
+		}
+		/* Input: `dev`. */
+		if (p == NULL) {
+			planrun(m);
+			printdev(m, 1);
+			pall = 0;
+			goto next;
+		} else if (shorthand) {
+			/*
+			 * Input: `dev=N` -> shorthand for `dev.volume=N`.
+			 *
+			 * We don't care what the rest of the string contains as
+			 * long as we're sure the very beginning is right,
+			 * mod_volume() will take care of parsing it properly.
+			 */
+			cp = mixer_get_ctl(m->dev, C_VOL);
+			cp->mod(cp->parent_dev, p);
+			goto next;
+		}
+		ctlstr = strsep(&p, "=");
+		if ((cp = mixer_get_ctl_byname(m->dev, ctlstr)) == NULL) {
+			warnx("%s.%s: no such control", devstr, ctlstr);
+			goto next;
+		}
+		/* Input: `dev.control`. */
+		if (p == NULL) {
+			planrun(m);
+			(void)cp->print(cp->parent_dev,
+			    __DECONST(char *, cp->name));
+			pall = 0;
+			goto next;
+		}
+		valstr = p;
+		/* Input: `dev.control=val`. */
+		cp->mod(cp->parent_dev, valstr);
+next:
+		MIXERCMD_CMD_RETURN(*argv);
+		free(arg);
+		argc--;
+		argv++;
+	}
+
+	return (pall);
+}
+
+/*
+ * Modify all mixers at once, each from its own thread, then print them.
+ * Every mixer gets its own plan from the same arguments, so relative
+ * changes and toggles work from each mixer's own state.
+ */
+static void
+allmixers(int argc, char *argv[], int oflag, int sflag)
+{
+	struct mix_group *g;
+	struct mixer *m;
+	struct plan *plans;
+	char pfx[sizeof(m->mi.name) + 2];
+	int i, n;
+
+	for (i = 0; i < argc; i++) {
+		if (strchr(argv[i], '=') == NULL)
+			errx(1, "%s: cannot be displayed with -a", argv[i]);
+	}
+	if ((g = mixer_group_open(NULL, 0)) == NULL)
+		err(1, "mixer_group_open");
+	n = mixer_group_count(g);
+	if ((plans = calloc(n, sizeof(struct plan))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++) {
+		/* Units that cannot be opened are left out. */
+		if ((m = mixer_group_get(g, i)) == NULL) {
+			warn("mixer_open: /dev/mixer%d", mixer_group_unit(g, i));
+			continue;
+		}
+		initctls(m);
+		if (argc > 0) {
+			(void)parseargs(m, argc, argv);
+			plans[i] = plan;
+			plan.nmod = 0;
+		}
+	}
+	(void)mixer_group_apply(g, groupwrite, plans, NULL);
+	for (i = 0; i < n; i++) {
+		if ((m = mixer_group_get(g, i)) == NULL)
+			continue;
+		(void)snprintf(pfx, sizeof(pfx), "%s: ", m->mi.name);
+		planprint(m, &plans[i], pfx);
+	}
+	for (i = 0; i < n; i++) {
+		if ((m = mixer_group_get(g, i)) == NULL)
+			continue;
+		if (sflag)
+			printrecsrc(m, oflag);
+		else {
+			printall(m, oflag);
+			if (oflag)
+				printf("\n");
+		}
+	}
+	free(plans);
+	(void)mixer_group_close(g);
+}
+
+/*
+ * Run one mixer's plan; called from the mixer's own thread. Failed writes
+ * are reported afterwards by planprint().
+ */
+static int
+groupwrite(struct mixer *m, int i, void *arg)
+{
+	struct plan *plans = arg;
+
+	(void)planwrite(m, &plans[i]);
+
+	return (0);
+}
+
+/*
+ * Parse an absolute volume, `L[:R]` with each side optionally given in
+ * percent.
+ */
+static int
+parsevol(const char *val, mix_volume_t *v)
+{
+	char *endp;
+
+	v->left = strtof(val, &endp);
+	if (*endp == '%') {
+		v->left /= 100.0f;
+		endp++;
+	}
+	v->right = v->left;
+	if (*endp == ':') {
+		v->right = strtof(endp + 1, &endp);
+		if (*endp == '%') {
+			v->right /= 100.0f;
+			endp++;
+		}
+	}
+	if (endp == val || *endp != '\0' ||
+	    v->left < MIX_VOLMIN || v->left > MIX_VOLMAX ||
+	    v->right < MIX_VOLMIN || v->right > MIX_VOLMAX)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Load preset `name` from `file`. A preset starts with its name in brackets
+ * on a line of its own and is followed by `dev.control=value` arguments,
+ * such as the ones `-o` prints, until the next preset. Values are absolute:
+ * volumes, 0 or 1 for mute, and + or - for recsrc. If the preset makes any
+ * device a recording source, the devices it does not mention stop being
+ * sources.
+ */
+static struct mix_preset *
+loadpreset(struct mixer *m, const char *file, const char *name)
+{
+	struct mix_preset_ent *ent = NULL, *e;
+	struct mix_preset *p = NULL;
+	struct mix_dev *dp;
+	FILE *fp;
+	char *line = NULL, *s, *tok, *devstr, *ctlstr, sep;
+	size_t linecap = 0;
+	int lineno = 0, in = 0, found = 0, srcmask = 0, anysrc = 0;
+	int n = 0, nalloc = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		warn("%s", file);
+		return (NULL);
+	}
+	while (getline(&line, &linecap, fp) > 0) {
+		lineno++;
+		if ((s = strchr(line, '#')) != NULL)
+			*s = '\0';
+		s = line + strspn(line, " \t");
+		if (*s == '[') {
+			tok = strsep(&s, "]");
+			in = !strcmp(tok + 1, name);
+			found |= in;
+			continue;
+		}
+		while (in && (tok = strsep(&s, " \t\n")) != NULL) {
+			if (*tok == '\0')
+				continue;
+			sep = tok[strcspn(tok, ".=")];
+			devstr = strsep(&tok, ".=");
+			if ((dp = mixer_get_dev_byname(m, devstr)) == NULL) {
+				warnx("%s:%d: %s: no such device", file,
+				    lineno, devstr);
+				goto fail;
+			}
+			/* `dev=N` is short for `dev.volume=N`. */
+			ctlstr = "volume";
+			if (sep == '.')
+				ctlstr = strsep(&tok, "=");
+			if (tok == NULL) {
+				warnx("%s:%d: %s: missing value", file,
+				    lineno, devstr);
+				goto fail;
+			}
+			if (n == nalloc) {
+				nalloc = nalloc ? nalloc * 2 : 16;
+				if ((e = reallocarray(ent, nalloc,
+				    sizeof(*ent))) == NULL) {
+					warn("%s", file);
+					goto fail;
+				}
+				ent = e;
+			}
+			e = &ent[n++];
+			memset(e, 0, sizeof(*e));
+			e->dev = dp->name;
+			if (!strcmp(ctlstr, "volume") &&
+			    parsevol(tok, &e->vol) == 0)
+				e->flags = MIX_PRESET_VOL;
+			else if (!strcmp(ctlstr, "mute") &&
+			    (*tok == '0' || *tok == '1') && tok[1] == '\0') {
+				e->flags = MIX_PRESET_MUTE;
+				e->mute = *tok == '1';
+			} else if (!strcmp(ctlstr, "recsrc") &&
+			    (*tok == '+' || *tok == '-') && tok[1] == '\0' &&
+			    MIX_ISREC(m, dp->devno)) {
+				e->flags = MIX_PRESET_RECSRC;
+				e->recsrc = *tok == '+';
+				srcmask |= 1 << dp->devno;
+				anysrc |= e->recsrc;
+			} else {
+				warnx("%s:%d: %s.%s=%s: invalid value", file,
+				    lineno, devstr, ctlstr, tok);
+				goto fail;
+			}
+		}
+	}
+	if (ferror(fp)) {
+		warn("%s", file);
+		goto fail;
+	}
+	if (!found) {
+		warnx("%s: %s: no such preset", file, name);
+		goto fail;
+	}
+	if (anysrc) {
+		TAILQ_FOREACH(dp, &m->devs, devs) {
+			if (!MIX_ISREC(m, dp->devno) ||
+			    MIX_ISSET(dp->devno, srcmask))
+				continue;
+			if (n == nalloc) {
+				nalloc = nalloc ? nalloc * 2 : 16;
+				if ((e = reallocarray(ent, nalloc,
+				    sizeof(*ent))) == NULL) {
+					warn("%s", file);
+					goto fail;
+				}
+				ent = e;
+			}
+			e = &ent[n++];
+			memset(e, 0, sizeof(*e));
+			e->dev = dp->name;
+			e->flags = MIX_PRESET_RECSRC;
+		}
+	}
+	if ((p = mixer_preset_compile(ent, n)) == NULL)
+		warn("%s: %s", file, name);
+fail:
+	free(ent);
+	free(line);
+	(void)fclose(fp);
+
+	return (p);
+}
+
+/*
+ * Apply a preset and print every control it changed, the same way planned
+ * modifications are printed.
+ */
+static void
+applypreset(struct mixer *m, const char *file, const char *name)
+{
+	struct mix_preset *p;
+	struct mix_dev *dp;
+	mix_volume_t prev[SOUND_MIXER_NRDEVICES];
+	int pmute, psrc, o, n;
+
+	if ((p = loadpreset(m, file, name)) == NULL)
+		return;
+	TAILQ_FOREACH(dp, &m->devs, devs)
+		prev[dp->devno] = dp->vol;
+	pmute = m->mutemask;
+	psrc = m->recsrc;
+	if (mixer_preset_apply(m, p) < 0)
+		warn("%s", name);
+	mixer_preset_free(p);
+	TAILQ_FOREACH(dp, &m->devs, devs) {
+		n = dp->devno;
+		if (MIX_VOLDENORM(prev[n].left) !=
+		    MIX_VOLDENORM(dp->vol.left) ||
+		    MIX_VOLDENORM(prev[n].right) !=
+		    MIX_VOLDENORM(dp->vol.right))
+			printf("%s.%s: %.2f:%.2f -> %.2f:%.2f\n", dp->name,
+			    mixer_get_ctl(dp, C_VOL)->name, prev[n].left,
+			    prev[n].right, dp->vol.left, dp->vol.right);
+		if ((o = MIX_ISSET(n, pmute)) != MIX_ISMUTE(m, n))
+			printf("%s.%s: %d -> %d\n", dp->name,
+			    mixer_get_ctl(dp, C_MUT)->name, o, !o);
+		if ((o = MIX_ISSET(n, psrc)) != MIX_ISRECSRC(m, n))
+			printf("%s.%s: %d -> %d\n", dp->name,
+			    mixer_get_ctl(dp, C_SRC)->name, o, !o);
+	}
+}
+
+static int
+mod_volume(struct mix_dev *d, void *p)
+{
+	mix_volume_t v, *pv;
 	const char *val;
 	char *endp, lstr[8], rstr[8];
-	float lprev, rprev, lrel, rrel;
+	float lrel, rrel;
 	int n;
 
-	m = d->parent_mixer;
-	cp = mixer_get_ctl(m->dev, C_VOL);
 	val = p;
 	n = sscanf(val, "%7[^:]:%7s", lstr, rstr);
 	if (n == EOF) {
@@ -374,10 +925,18 @@ mod_volume(struct mix_dev *d, void *p)
 		v.right = v.left; /* FALLTHROUGH */
 		rrel = lrel;
 	case 2:
+		/* Relative steps build on the previously planned value. */
+		planadd(d, C_VOL);
+		pv = &plan.vol[d->devno];
+		if (lrel && rrel) {
+			plan.step[d->devno].left += v.left;
+			plan.step[d->devno].right += v.right;
+		} else
+			plan.relmask &= ~(1 << d->devno);
 		if (lrel)
-			v.left += m->dev->vol.left;
+			v.left += pv->left;
 		if (rrel)
-			v.right += m->dev->vol.right;
+			v.right += pv->right;
 
 		if (v.left < MIX_VOLMIN)
 			v.left = MIX_VOLMIN;
@@ -388,14 +947,12 @@ mod_volume(struct mix_dev *d, void *p)
 		else if (v.right > MIX_VOLMAX)
 			v.right = MIX_VOLMAX;
 
-		lprev = m->dev->vol.left;
-		rprev = m->dev->vol.right;
-		if (mixer_set_vol(m, v) < 0)
-			warn("%s.%s=%.2f:%.2f",
-			    m->dev->name, cp->name, v.left, v.right);
-		else
-			printf("%s.%s: %.2f:%.2f -> %.2f:%.2f\n",
-			   m->dev->name, cp->name, lprev, rprev, v.left, v.right);
+		/*
+		 * The device only stores whole percentages, so round the
+		 * same way a write followed by a read back would.
+		 */
+		pv->left = MIX_VOLNORM(MIX_VOLDENORM(v.left));
+		pv->right = MIX_VOLNORM(MIX_VOLDENORM(v.right));
 	}
 
 	return (0);
@@ -404,34 +961,27 @@ mod_volume(struct mix_dev *d, void *p)
 static int
 mod_mute(struct mix_dev *d, void *p)
 {
-	struct mixer *m;
-	mix_ctl_t *cp;
 	const char *val;
-	int n, opt = -1;
+	int bit, opt;
 
-	m = d->parent_mixer;
-	cp = mixer_get_ctl(m->dev, C_MUT);
 	val = p;
-	switch (*val) {
-	case '0':
-		opt = MIX_UNMUTE;
+	if ((opt = muteopt(*val)) < 0) {
+		warnx("%c: no such modifier", *val);
+		return (-1);
+	}
+	planadd(d, C_MUT);
+	bit = 1 << d->devno;
+	switch (opt) {
+	case MIX_MUTE:
+		plan.mutemask |= bit;
 		break;
-	case '1':
-		opt = MIX_MUTE;
+	case MIX_UNMUTE:
+		plan.mutemask &= ~bit;
 		break;
-	case '^':
-		opt = MIX_TOGGLEMUTE;
+	case MIX_TOGGLEMUTE:
+		plan.mutemask ^= bit;
 		break;
-	default:
-		warnx("%c: no such modifier", *val);
-		return (-1);
 	}
-	n = MIX_ISMUTE(m, m->dev->devno);
-	if (mixer_set_mute(m, opt) < 0)
-		warn("%s.%s=%c", m->dev->name, cp->name, *val);
-	else
-		printf("%s.%s: %d -> %d\n",
-		    m->dev->name, cp->name, n, MIX_ISMUTE(m, m->dev->devno));
 
 	return (0);
 }
@@ -440,36 +990,36 @@ static int
 mod_recsrc(struct mix_dev *d, void *p)
 {
 	struct mixer *m;
-	mix_ctl_t *cp;
 	const char *val;
-	int n, opt = -1;
+	int bit, opt;
 
 	m = d->parent_mixer;
-	cp = mixer_get_ctl(m->dev, C_SRC);
 	val = p;
-	switch (*val) {
-	case '+':
-		opt = MIX_ADDRECSRC;
+	if ((opt = recsrcopt(*val)) < 0) {
+		warnx("%c: no such modifier", *val);
+		return (-1);
+	}
+	if (!m->recmask || !MIX_ISREC(m, d->devno)) {
+		errno = ENODEV;
+		warn("%s.%s=%c", d->name, mixer_get_ctl(d, C_SRC)->name, *val);
+		return (-1);
+	}
+	planadd(d, C_SRC);
+	bit = 1 << d->devno;
+	switch (opt) {
+	case MIX_ADDRECSRC:
+		plan.recsrc |= bit;
 		break;
-	case '-':
-		opt = MIX_REMOVERECSRC;
+	case MIX_REMOVERECSRC:
+		plan.recsrc &= ~bit;
 		break;
-	case '=':
-		opt = MIX_SETRECSRC;
+	case MIX_SETRECSRC:
+		plan.recsrc = bit;
 		break;
-	case '^':
-		opt = MIX_TOGGLERECSRC;
+	case MIX_TOGGLERECSRC:
+		plan.recsrc ^= bit;
 		break;
-	default:
-		warnx("%c: no such modifier", *val);
-		return (-1);
 	}
-	n = MIX_ISRECSRC(m, m->dev->devno);
-	if (mixer_mod_recsrc(m, opt) < 0)
-		warn("%s.%s=%c", m->dev->name, cp->name, *val);
-	else
-		printf("%s.%s: %d -> %d\n",
-		    m->dev->name, cp->name, n, MIX_ISRECSRC(m, m->dev->devno));
 
 	return (0);
 }